@@ -5,11 +5,21 @@
  *      Author: Lev
  */
 
+#define _GNU_SOURCE // for pthread_setaffinity_np
 #include "my_list.h"
+#include "my_list_trace.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 /*------------------------- Lock types and definitions -----------------------*/
 
@@ -97,37 +107,474 @@ int mutex_unlock_safe(mutex_t* lock){
 	return lock ? pthread_mutex_unlock(lock) : 0;
 }
 
+/*--------------------------------- Capture ----------------------------------*/
+
+/* While capture is on (see list_capture_start), every list op but the
+ * frees and splits logs a record (and batch and txn one more per op) for
+ * replay. Every
+ * thread fills its own buffer, and appends it to the file (under
+ * capture_mutex) when it's full; list_capture_stop writes the rest.
+ * Ops which other ops call (on shards of a list split online) aren't
+ * logged, as replaying the outer op repeats them. Off, capture costs a
+ * load per op. */
+#define CAPTURE_BUFFER_SIZE 4096
+
+typedef struct capture_buffer_t {
+	struct capture_buffer_t* next; // in registry
+	uint16_t thread;
+	int count;
+	capture_record_t records[CAPTURE_BUFFER_SIZE];
+} capture_buffer_t;
+
+static int capture_on;
+static unsigned capture_generation; // of the capture buffers belong to
+static FILE* capture_file;
+static int capture_write_failed;
+static uint64_t capture_start_ns;
+static capture_buffer_t* capture_buffers;
+static uint16_t capture_num_threads;
+static mutex_t capture_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread capture_buffer_t* capture_buffer;
+static __thread unsigned capture_buffer_generation;
+static __thread int capture_depth; // of nested ops
+
+static inline uint64_t clock_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//required locks: capture_mutex
+static void capture_flush(capture_buffer_t* buffer) {
+	if (buffer->count && fwrite(buffer->records, sizeof(capture_record_t),
+			buffer->count, capture_file) != (size_t) buffer->count)
+		capture_write_failed = 1;
+	buffer->count = 0;
+}
+
+//@Return: buffer of the calling thread, or NULL if capture stopped
+static capture_buffer_t* capture_get_buffer() {
+	if (capture_buffer && capture_buffer_generation
+			== __atomic_load_n(&capture_generation, __ATOMIC_ACQUIRE))
+		return capture_buffer;
+	capture_buffer_t* buffer = malloc(sizeof(*buffer));
+	if (!buffer)
+		return NULL; // thread goes uncaptured
+	pthread_mutex_lock(&capture_mutex);
+	if (!capture_file) {
+		pthread_mutex_unlock(&capture_mutex);
+		free(buffer);
+		return NULL;
+	}
+	buffer->thread = capture_num_threads++;
+	buffer->count = 0;
+	buffer->next = capture_buffers;
+	capture_buffers = buffer;
+	capture_buffer_generation = capture_generation;
+	pthread_mutex_unlock(&capture_mutex);
+	return capture_buffer = buffer;
+}
+
+static void capture_record(uint8_t op, int key, uint8_t member_op,
+		uint64_t ts) {
+	capture_buffer_t* buffer = capture_get_buffer();
+	if (!buffer)
+		return;
+	if (buffer->count == CAPTURE_BUFFER_SIZE) {
+		pthread_mutex_lock(&capture_mutex);
+		capture_flush(buffer);
+		pthread_mutex_unlock(&capture_mutex);
+	}
+	capture_record_t* record = &buffer->records[buffer->count++];
+	record->ts = ts;
+	record->key = key;
+	record->thread = buffer->thread;
+	record->op = op;
+	record->member_op = member_op;
+}
+
+static inline void capture_op_start(trace_op_t op, int key) {
+	if (capture_depth++ || !__atomic_load_n(&capture_on, __ATOMIC_ACQUIRE))
+		return;
+	capture_record(op, key, 0, clock_ns() - capture_start_ns);
+}
+
+static inline void capture_op_end() {
+	if (capture_depth)
+		capture_depth--;
+}
+
+//logs ops of a batch or txn, right after its own record
+static void capture_members(op_t* ops, int num_ops) {
+	if (capture_depth != 1 || !__atomic_load_n(&capture_on, __ATOMIC_ACQUIRE))
+		return;
+	uint64_t ts = clock_ns() - capture_start_ns;
+	for (int i = 0; i < num_ops; i++)
+		capture_record(CAPTURE_MEMBER, ops[i].key, ops[i].op, ts);
+}
+
+/*--------------------------------- Tracing ----------------------------------*/
+
+/* With MY_LIST_TRACE, every thread records events into its own ring, which
+ * keeps its last TRACE_RING_SIZE events. Only the owner writes a ring, and
+ * publishes each event by advancing head, so recording takes no locks;
+ * trace_mutex only guards the registry of rings. Rings outlive threads, so
+ * their events can still be dumped, but once its thread exits, a ring is
+ * taken over by the next thread which starts tracing, so short lived
+ * threads (of list_batch, list_for_each...) don't pile up rings; its old
+ * events stay until overwritten. Timestamps are raw TSC reads where
+ * available (cheaper than clock_gettime); the dump converts them to ns by
+ * the rate measured since the 1st ring was created.
+ * Without MY_LIST_TRACE trace calls only feed the capture. */
+#ifdef MY_LIST_TRACE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TRACE_TSC
+#endif
+
+#define TRACE_RING_SIZE 4096
+
+typedef struct trace_ring_t {
+	struct trace_ring_t* next; // in registry
+	int free; // its thread exited
+	uint32_t thread;
+	uint8_t op; // op in progress, for lock waits
+	int32_t key;
+	uint64_t head; // number of events written
+	trace_event_t events[TRACE_RING_SIZE];
+} trace_ring_t;
+
+static __thread trace_ring_t* trace_ring;
+static __thread int trace_ring_failed;
+static trace_ring_t* trace_rings;
+static uint32_t trace_num_threads;
+static uint64_t trace_start_ticks, trace_start_ns; // for ns_per_tick
+static mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t trace_key; // frees the ring of an exiting thread
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+
+static inline uint64_t trace_now() {
+#ifdef TRACE_TSC
+	return __rdtsc();
+#else
+	return clock_ns();
+#endif
+}
+
+//runs on the exiting thread, which traces nothing more
+static void free_trace_ring(void* ring) {
+	trace_ring = NULL;
+	trace_ring_failed = 1;
+	pthread_mutex_lock(&trace_mutex);
+	((trace_ring_t*) ring)->free = 1;
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+static void create_trace_key() {
+	pthread_key_create(&trace_key, free_trace_ring);
+}
+
+static trace_ring_t* trace_get_ring() {
+	if (trace_ring || trace_ring_failed)
+		return trace_ring;
+	pthread_once(&trace_key_once, create_trace_key);
+	pthread_mutex_lock(&trace_mutex);
+	trace_ring_t* ring = trace_rings;
+	while (ring && !ring->free)
+		ring = ring->next;
+	if (ring)
+		ring->free = 0;
+	pthread_mutex_unlock(&trace_mutex);
+	if (!ring) {
+		if (!(ring = calloc(1, sizeof(*ring)))) {
+			trace_ring_failed = 1; // thread goes untraced
+			return NULL;
+		}
+		pthread_mutex_lock(&trace_mutex);
+		if (!trace_rings) {
+			trace_start_ticks = trace_now();
+			trace_start_ns = clock_ns();
+		}
+		ring->thread = trace_num_threads++;
+		ring->next = trace_rings;
+		trace_rings = ring;
+		pthread_mutex_unlock(&trace_mutex);
+	}
+	pthread_setspecific(trace_key, ring);
+	return trace_ring = ring;
+}
+
+static void trace_event(int type, int op, int key, uint32_t arg, int result) {
+	trace_ring_t* ring = trace_get_ring();
+	if (!ring)
+		return;
+	trace_event_t* event = &ring->events[ring->head % TRACE_RING_SIZE];
+	event->ts = trace_now();
+	event->key = key;
+	event->arg = arg;
+	event->type = type;
+	event->op = op;
+	event->result = result;
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+static inline void trace_op_start(trace_op_t op, int key) {
+	capture_op_start(op, key);
+	trace_event(TRACE_OP_START, op, key, 0, 0);
+	if (trace_ring) {
+		trace_ring->op = op;
+		trace_ring->key = key;
+	}
+}
+
+//returns res, so ops can end by return trace_op_end(...)
+static inline int trace_op_end(trace_op_t op, int key, int res) {
+	capture_op_end();
+	trace_event(TRACE_OP_END, op, key, 0, res > INT16_MAX ? INT16_MAX : res);
+	return res;
+}
+
+static inline void trace_cleanup(trace_event_type_t type, trace_op_t op,
+		uint64_t wait_start, int res) {
+	uint64_t waited = wait_start ? trace_now() - wait_start : 0;
+	trace_event(type, op, 0, waited > UINT32_MAX ? UINT32_MAX : waited, res);
+}
+
+//locks, recording the wait if lock was contended
+static inline void lock_traced(mutex_t* lock) {
+	if (!pthread_mutex_trylock(lock))
+		return;
+	uint64_t start = trace_now();
+	pthread_mutex_lock(lock);
+	uint64_t waited = trace_now() - start;
+	trace_event(TRACE_LOCK_WAIT, trace_ring ? trace_ring->op : 0,
+			trace_ring ? trace_ring->key : 0,
+			waited > UINT32_MAX ? UINT32_MAX : waited, 0);
+}
+
+static inline uint64_t trace_cleanup_wait(trace_op_t op) {
+	trace_event(TRACE_CLEANUP_WAIT, op, 0, 0, 0);
+	return trace_now();
+}
+
+#else
+
+static inline void trace_op_start(trace_op_t op, int key) {
+	capture_op_start(op, key);
+}
+static inline int trace_op_end(trace_op_t op, int key, int res) {
+	(void) op;
+	(void) key;
+	capture_op_end();
+	return res;
+}
+static inline void trace_cleanup(trace_event_type_t type, trace_op_t op,
+		uint64_t wait_start, int res) {
+	(void) type;
+	(void) op;
+	(void) wait_start;
+	(void) res;
+}
+static inline void lock_traced(mutex_t* lock) {
+	pthread_mutex_lock(lock);
+}
+static inline uint64_t trace_cleanup_wait(trace_op_t op) {
+	(void) op;
+	return 0;
+}
+
+#endif /* MY_LIST_TRACE */
+
+/*--------------------------- Counting Bloom filter --------------------------*/
+
+//64 bit mix of key (splitmix64 finalizer), shared by the filter and the index
+static inline unsigned long long hash_key(int key) {
+	unsigned long long h = (unsigned) key;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	return h ^ (h >> 31);
+}
+
+/* Counting Bloom filter of keys in list. A zero counter means no key in list
+ * hashes to it, so a key with a zero counter is definitely not in list.
+ * Key is counted before it's linked, and uncounted after it's unlinked, so
+ * the filter never misses a key which is in list.
+ * Counters saturate at BLOOM_COUNTER_MAX and then stay there forever. */
+#define BLOOM_COUNTER_MAX 255
+#define BLOOM_MAX_HASHES 16
+
+typedef struct bloom_t {
+	unsigned num_counters, num_hashes;
+	unsigned char counters[];
+} bloom_t;
+
+/* @Return: filter sized for expected_keys with false positive rate fp_rate,
+ * or NULL on invalid arguments or allocation failure */
+static bloom_t* bloom_alloc(int expected_keys, double fp_rate) {
+	if (expected_keys <= 0 || fp_rate <= 0 || fp_rate >= 1)
+		return NULL;
+	// optimal number of hashes is log2(1/fp_rate), and counters - hashes*n/ln2
+	unsigned num_hashes = 0;
+	for (double p = fp_rate; p < 1 && num_hashes < BLOOM_MAX_HASHES; p *= 2)
+		num_hashes++;
+	unsigned long long num_counters = expected_keys * 1443ULL * num_hashes / 1000 + 1;
+	if (num_counters > UINT_MAX)
+		return NULL;
+
+	bloom_t* bloom = calloc(1, sizeof(*bloom) + num_counters);
+	if (!bloom)
+		return NULL;
+	bloom->num_counters = num_counters;
+	bloom->num_hashes = num_hashes;
+	return bloom;
+}
+
+/* i-th counter of key, by double hashing with halves of a 64 bit mix */
+static inline unsigned char* bloom_counter(bloom_t* bloom, int key, unsigned i) {
+	unsigned long long h = hash_key(key);
+	unsigned h1 = h, h2 = (h >> 32) | 1;
+	return &bloom->counters[(h1 + i * h2) % bloom->num_counters];
+}
+
+static void bloom_add(bloom_t* bloom, int key) {
+	for (unsigned i = 0; i < bloom->num_hashes; i++) {
+		unsigned char* counter = bloom_counter(bloom, key, i);
+		unsigned char old = __atomic_load_n(counter, __ATOMIC_RELAXED);
+		while (old < BLOOM_COUNTER_MAX && !__atomic_compare_exchange_n(counter,
+				&old, old + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+			;
+	}
+}
+
+static void bloom_remove(bloom_t* bloom, int key) {
+	for (unsigned i = 0; i < bloom->num_hashes; i++) {
+		unsigned char* counter = bloom_counter(bloom, key, i);
+		unsigned char old = __atomic_load_n(counter, __ATOMIC_RELAXED);
+		while (old > 0 && old < BLOOM_COUNTER_MAX
+				&& !__atomic_compare_exchange_n(counter, &old, old - 1, 0,
+						__ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+			;
+	}
+}
+
+/* @Return:
+ *   0 - key is definitely not in list
+ *   1 - key may be in list
+ */
+static int bloom_may_contain(bloom_t* bloom, int key) {
+	for (unsigned i = 0; i < bloom->num_hashes; i++)
+		if (!__atomic_load_n(bloom_counter(bloom, key, i), __ATOMIC_SEQ_CST))
+			return 0;
+	return 1;
+}
+
 /*-------------------------List types and definitions-------------------------*/
 
-typedef struct node_t {
-	int key;
-	void* data;
-	struct node_t* next;
-	mutex_t lock;
-} node_t;
+#define CACHE_LINE_SIZE 64
+
+/* A node is a list_hook_t (see my_list.h): fields used by traversal (key,
+ * next and lock) come first, so they share a cache line; data is only needed
+ * once the node is found. Nodes allocated by the list are cache line aligned,
+ * so such a node never straddles two lines. Intrusive nodes are embedded in
+ * their owner's objects, and are never freed by the list. */
+typedef list_hook_t node_t;
+
+#define NODE_INTRUSIVE 1
+#define NODE_IN_BLOCK 2 // moved into a block by list_compact
+#define NODE_FROZEN 4 // a frozen_node_t, see list_freeze
+/* Besides the bits above, flags count the readers of node data (computes
+ * in progress, see wait_for_readers), in units of NODE_READER. */
+#define NODE_READER 8
 
 struct linked_list_t {
 	node_t* head;
 	int size;
 	rc_lock_t cleanup_lock;
 	mutex_t size_lock, head_ptr_lock;
+	list_config_t config;
+	bloom_t* bloom; // NULL if disabled
+	struct hash_index_t* index; // NULL if disabled
+	struct read_cache_t* cache; // NULL if disabled
+	/* Adaptive locking (if config.adaptive_locking): in coarse mode point ops
+	 * hold mode_lock exclusively and skip node locks, in fine mode every op
+	 * holds it shared and uses hand-over-hand locking. */
+	pthread_rwlock_t mode_lock;
+	int coarse;
+	unsigned window_ops, window_contended;
+	unsigned long mode_switches;
+	/* Online split (see list_split_online): while RESHARD_ACTIVE, keys below
+	 * moved_below were moved to shards (shard i gets keys from
+	 * shard_bounds[i-1] up to shard_bounds[i]), and the rest are still here */
+	int resharding;
+	long long moved_below;
+	linked_list_t** shards;
+	int* shard_bounds;
+	int num_bounds;
+	int frozen_nodes; // linked frozen nodes, whose keys aren't indexed
+	int whole_ops; // ops on the whole list in progress, see enter_whole_op
+	/* Change feed: subs are changed under subs_lock exclusively, and events
+	 * are delivered under it shared */
+	pthread_rwlock_t subs_lock;
+	list_subscription_t** subs;
+	int num_subs;
+	unsigned long event_seq;
 };
 
+/* Key range [lo, hi) of the list, visited by one thread.
+ * First segment has lo = INT_MIN, last one has no upper bound. */
+typedef struct segment_t {
+	linked_list_t* list;
+	int lo, hi, has_hi;
+	void (*visit)(struct segment_t* segment, int key, void* data);
+	void (*func)(int key, void* data, void* ctx); // for list_for_each
+	int (*reduce_func)(int acc, int key, void* data, void* ctx); // for list_reduce
+	void* ctx;
+	int acc;
+	node_t* start; // 1st node of segment to lock, see visit_in_parallel
+	int started; // start was locked
+} segment_t;
+
+/* Order in which batch workers lock the list head: only the worker with
+ * index next_worker may do it now. */
+typedef struct batch_start_t {
+	mutex_t lock;
+	pthread_cond_t turn;
+	int next_worker;
+} batch_start_t;
+
+/* Batch ops of one worker: a key range, sorted by key, and ops with the
+ * same key - by their original batch order */
 typedef struct list_params_t {
 	linked_list_t* list;
-	op_t* op_param;
+	op_t** ops;
+	int num_ops;
+	batch_start_t* start;
+	int worker;
+	int cpu; // -1 - no affinity
+	int thread_created;
+	// results go to on_result (if set) once the range is applied
+	void (*on_result)(int index, const op_t* op, void* ctx);
+	void* ctx;
+	const op_t* base; // index of an op is its offset from base
 } list_params_t;
 
-enum list_error {
-	SUCCESS = 0,
-	NULL_ARG = 2,
-	INVALID_ARG,
-	MEM_ERROR,
-	NOT_FOUND,
-	ALREADY_IN_LIST,
-	CLEANUP_PENDING
+/* Reusable batch: ops are kept in an arena, which only grows, along with
+ * the scratch list_batch allocates on every call, so a batch no bigger than
+ * the previous ones allocates nothing. */
+struct list_batch_t {
+	op_t* ops;
+	op_t** sorted;
+	int num_ops;
+	int capacity;
+	pthread_t* threads;
+	list_params_t* params;
+	int max_workers;
 };
 
+#define BATCH_MIN_CAPACITY 16 // ops
+#define BATCH_OPS_PER_WORKER 256 // list_batch_run spawns no more workers
+
 #define MALLOC_N_ORELSE(identifier, N, command) do {\
 	identifier = malloc(sizeof(*(identifier))*(N)); \
 	if(!(identifier)) { \
@@ -137,205 +584,3142 @@ enum list_error {
 #define MALLOC_ORELSE(identifier, command) \
 		MALLOC_N_ORELSE(identifier, 1, command)
 
+/* Prefetching next node while current one is locked hides part of the miss
+ * of the next step. Define MY_LIST_NO_PREFETCH to compare without it. */
+#ifndef MY_LIST_NO_PREFETCH
+#define PREFETCH(ptr) __builtin_prefetch(ptr)
+#else
+#define PREFETCH(ptr) ((void)(ptr))
+#endif
+
+/*------------------------------- Hash index ---------------------------------*/
+
+/* Index from key to its node, for point ops which don't need the previous
+ * node. A key is indexed before its node is linked, and unindexed after it's
+ * unlinked (both while the locks needed to link/unlink it are held), so
+ * while the index is complete, a key which isn't indexed isn't in list.
+ * Lookup locks bucket, then only tries to lock the node, while (un)linking
+ * locks node, then bucket - so they can't deadlock. */
+#define INDEX_LOCK_ATTEMPTS 64
+
+typedef struct index_entry_t {
+	int key;
+	node_t* node;
+} index_entry_t;
+
+typedef struct index_bucket_t {
+	mutex_t lock;
+	index_entry_t* entries;
+	int count, capacity;
+} index_bucket_t;
+
+typedef struct hash_index_t {
+	unsigned num_buckets;
+	int complete; // 0 after an entry couldn't be added
+	index_bucket_t buckets[];
+} hash_index_t;
+
+static hash_index_t* index_alloc(int num_buckets) {
+	if (num_buckets <= 0)
+		return NULL;
+	hash_index_t* index = malloc(sizeof(*index)
+			+ num_buckets * sizeof(index->buckets[0]));
+	if (!index)
+		return NULL;
+	index->num_buckets = num_buckets;
+	index->complete = 1;
+	for (int i = 0; i < num_buckets; i++) {
+		pthread_mutex_init(&index->buckets[i].lock, NULL);
+		index->buckets[i].entries = NULL;
+		index->buckets[i].count = index->buckets[i].capacity = 0;
+	}
+	return index;
+}
+
+static void index_free(hash_index_t* index) {
+	if (!index)
+		return;
+	for (unsigned i = 0; i < index->num_buckets; i++) {
+		pthread_mutex_destroy(&index->buckets[i].lock);
+		free(index->buckets[i].entries);
+	}
+	free(index);
+}
+
+static inline index_bucket_t* index_bucket(hash_index_t* index, int key) {
+	return &index->buckets[hash_key(key) % index->num_buckets];
+}
+
+static void index_add(hash_index_t* index, node_t* node) {
+	index_bucket_t* bucket = index_bucket(index, node->key);
+	pthread_mutex_lock(&bucket->lock);
+	if (bucket->count == bucket->capacity) {
+		int capacity = bucket->capacity ? bucket->capacity * 2 : 2;
+		index_entry_t* entries = realloc(bucket->entries,
+				capacity * sizeof(*entries));
+		if (!entries) {
+			__atomic_store_n(&index->complete, 0, __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&bucket->lock);
+			return;
+		}
+		bucket->entries = entries;
+		bucket->capacity = capacity;
+	}
+	bucket->entries[bucket->count].key = node->key;
+	bucket->entries[bucket->count].node = node;
+	bucket->count++;
+	pthread_mutex_unlock(&bucket->lock);
+}
+
+//points the entry of node to replacement (of the same key)
+static void index_replace(hash_index_t* index, node_t* node,
+		node_t* replacement) {
+	index_bucket_t* bucket = index_bucket(index, node->key);
+	pthread_mutex_lock(&bucket->lock);
+	for (int i = 0; i < bucket->count; i++) {
+		if (bucket->entries[i].node == node) {
+			bucket->entries[i].node = replacement;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&bucket->lock);
+}
+
+static void index_remove(hash_index_t* index, node_t* node) {
+	index_bucket_t* bucket = index_bucket(index, node->key);
+	pthread_mutex_lock(&bucket->lock);
+	for (int i = 0; i < bucket->count; i++) {
+		if (bucket->entries[i].node == node) {
+			bucket->entries[i] = bucket->entries[--bucket->count];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&bucket->lock);
+}
+
+/* Looks key up, and locks its node.
+ * @Return: locked node with key, or NULL (and then *busy tells whether key
+ * is indexed, but its node was locked by others for too long).
+ */
+static node_t* index_lookup(hash_index_t* index, int key, int* busy) {
+	index_bucket_t* bucket = index_bucket(index, key);
+	node_t* found = NULL;
+	*busy = 0;
+	pthread_mutex_lock(&bucket->lock);
+	for (int i = 0; i < bucket->count; i++) {
+		if (bucket->entries[i].key != key)
+			continue;
+		node_t* node = bucket->entries[i].node;
+		for (int attempt = 0; attempt < INDEX_LOCK_ATTEMPTS && !found; attempt++)
+			if (!pthread_mutex_trylock(&node->lock))
+				found = node;
+		*busy = !found;
+		break;
+	}
+	pthread_mutex_unlock(&bucket->lock);
+	return found;
+}
+
+/*----------------------------- Frozen segments ------------------------------*/
+
+/* list_freeze replaces long runs of nodes by frozen nodes. A frozen node
+ * stands for a view (range of positions) of a frozen segment: a read-only,
+ * sorted array of keys, delta-encoded against the 1st key of their group,
+ * and of their data - about 10 bytes per key, instead of a node's 64. It's
+ * linked like any node, with the 1st key of its view as its key, and no
+ * other node has a key in its range (up to last_key), so a walk to a key in
+ * the range ends at it (see frozen_at).
+ * Updates and removals of its keys change it in place, under its lock: a
+ * removed key is only marked so. Inserting a key into its range splits it:
+ * the keys above the new node get a view of their own, over the same
+ * segment, and views left with few keys go back to nodes (see split_frozen),
+ * or join a run on the next list_freeze. Frozen keys aren't in the hash
+ * index. */
+#define FROZEN_GROUP 16 // keys per group, which share a base key
+#define FROZEN_MAX_KEYS 4096 // per segment
+#define FROZEN_THAW_KEYS 4 // split views left with fewer keys go back to nodes
+
+typedef struct frozen_seg_t {
+	int refs; // views of it
+	int width; // of key offsets, in bytes: 1, 2 or 4
+	void** datas;
+	int* bases; // 1st key of every group
+	void* offsets; // of every key from the base of its group
+	unsigned char* removed; // bit per key, a byte may be shared by 2 views
+} frozen_seg_t;
+
+typedef struct frozen_node_t {
+	node_t node; // flags has NODE_FROZEN
+	frozen_seg_t* seg;
+	int begin, end; // view of seg
+	int live; // keys of the view, which weren't removed
+	int last_key; // key at end - 1, removed or not
+} frozen_node_t;
+
+static inline frozen_node_t* as_frozen(node_t* node) {
+	// flags change under computes, which don't hold the node lock
+	return node && (__atomic_load_n(&node->flags, __ATOMIC_RELAXED) & NODE_FROZEN)
+			? (frozen_node_t*) node : NULL;
+}
+
+//number of keys in node
+static inline int keys_in(node_t* node) {
+	frozen_node_t* frozen = as_frozen(node);
+	return frozen ? frozen->live : 1;
+}
+
+static inline int frozen_key(const frozen_seg_t* seg, int i) {
+	unsigned offset = seg->width == 1 ? ((const uint8_t*) seg->offsets)[i]
+			: seg->width == 2 ? ((const uint16_t*) seg->offsets)[i]
+			: ((const uint32_t*) seg->offsets)[i];
+	return (int) ((unsigned) seg->bases[i / FROZEN_GROUP] + offset);
+}
+
+static inline int frozen_removed(const frozen_seg_t* seg, int i) {
+	return __atomic_load_n(&seg->removed[i / 8], __ATOMIC_RELAXED) >> (i % 8) & 1;
+}
+
+//counts offsets below target in [first, last), branch free, so it vectorizes
+#define COUNT_BELOW(type, offsets, first, last, target, count) do { \
+	const type* o = (const type*) (offsets); \
+	for (int j = (first); j < (last); j++) \
+		(count) += o[j] < (target); \
+	} while (0)
+
+/* Binary search over the bases of groups, then a count within the group.
+ * @Return: position of the 1st key >= key in the view of frozen, or its end
+ */
+static int frozen_search(const frozen_node_t* frozen, int key) {
+	const frozen_seg_t* seg = frozen->seg;
+	int lo = frozen->begin / FROZEN_GROUP, hi = (frozen->end - 1) / FROZEN_GROUP;
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		if (seg->bases[mid] <= key)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	int first = lo * FROZEN_GROUP, last = first + FROZEN_GROUP;
+	if (first < frozen->begin)
+		first = frozen->begin;
+	if (last > frozen->end)
+		last = frozen->end;
+	if (key < seg->bases[lo])
+		return first;
+	unsigned target = (unsigned) key - (unsigned) seg->bases[lo];
+	int count = 0;
+	if (seg->width == 1)
+		COUNT_BELOW(uint8_t, seg->offsets, first, last, target, count);
+	else if (seg->width == 2)
+		COUNT_BELOW(uint16_t, seg->offsets, first, last, target, count);
+	else
+		COUNT_BELOW(uint32_t, seg->offsets, first, last, target, count);
+	return first + count;
+}
+
+//@Return: position of key in the view of frozen, or -1 if it's not there
+static int frozen_find(const frozen_node_t* frozen, int key) {
+	int i = frozen_search(frozen, key);
+	return i < frozen->end && frozen_key(frozen->seg, i) == key
+			&& !frozen_removed(frozen->seg, i) ? i : -1;
+}
+
+//points frozen to [begin, end) of its segment (which must be non-empty)
+static void set_view(frozen_node_t* frozen, int begin, int end) {
+	assert(begin < end);
+	frozen->begin = begin;
+	frozen->end = end;
+	frozen->live = 0;
+	for (int i = begin; i < end; i++)
+		frozen->live += !frozen_removed(frozen->seg, i);
+	frozen->node.key = frozen_key(frozen->seg, begin);
+	frozen->last_key = frozen_key(frozen->seg, end - 1);
+}
+
+//@Return: uninitialized frozen node, or NULL
+static inline frozen_node_t* alloc_frozen() {
+	void* frozen;
+	if (posix_memalign(&frozen, CACHE_LINE_SIZE, sizeof(frozen_node_t)))
+		return NULL;
+	return frozen;
+}
+
+//initializes frozen (unlinked, unlocked) as a view of [begin, end) of seg
+static void init_frozen(frozen_node_t* frozen, frozen_seg_t* seg, int begin,
+		int end) {
+	frozen->node.flags = NODE_FROZEN;
+	frozen->node.data = NULL;
+	frozen->node.next = NULL;
+	pthread_mutex_init(&frozen->node.lock, NULL);
+	frozen->seg = seg;
+	__atomic_add_fetch(&seg->refs, 1, __ATOMIC_RELAXED);
+	set_view(frozen, begin, end);
+}
+
+/* Freezes count keys (sorted) and their data into a new segment.
+ * @Return: view of the whole segment, or NULL
+ */
+static frozen_node_t* freeze_keys(const int* keys, void* const* datas,
+		int count) {
+	assert(count > 0 && count <= FROZEN_MAX_KEYS);
+	int num_groups = (count + FROZEN_GROUP - 1) / FROZEN_GROUP;
+	unsigned max_offset = 0;
+	for (int i = 0; i < count; i++) {
+		unsigned offset = (unsigned) keys[i]
+				- (unsigned) keys[i / FROZEN_GROUP * FROZEN_GROUP];
+		if (offset > max_offset)
+			max_offset = offset;
+	}
+	int width = max_offset <= UINT8_MAX ? 1 : max_offset <= UINT16_MAX ? 2 : 4;
+	size_t size = sizeof(frozen_seg_t) + count * sizeof(void*)
+			+ num_groups * sizeof(int) + count * width + (count + 7) / 8;
+	frozen_seg_t* seg = malloc(size);
+	frozen_node_t* frozen = alloc_frozen();
+	if (!seg || !frozen) {
+		free(seg);
+		free(frozen);
+		return NULL;
+	}
+	seg->refs = 0;
+	seg->width = width;
+	seg->datas = (void**) (seg + 1);
+	seg->bases = (int*) (seg->datas + count);
+	seg->offsets = seg->bases + num_groups;
+	seg->removed = (unsigned char*) seg->offsets + count * width;
+	memset(seg->removed, 0, (count + 7) / 8);
+	for (int i = 0; i < count; i++) {
+		int base = keys[i / FROZEN_GROUP * FROZEN_GROUP];
+		unsigned offset = (unsigned) keys[i] - (unsigned) base;
+		if (i % FROZEN_GROUP == 0)
+			seg->bases[i / FROZEN_GROUP] = base;
+		if (width == 1)
+			((uint8_t*) seg->offsets)[i] = offset;
+		else if (width == 2)
+			((uint16_t*) seg->offsets)[i] = offset;
+		else
+			((uint32_t*) seg->offsets)[i] = offset;
+		seg->datas[i] = datas[i];
+	}
+	init_frozen(frozen, seg, 0, count);
+	return frozen;
+}
+
+static void release_seg(frozen_seg_t* seg) {
+	if (!__atomic_sub_fetch(&seg->refs, 1, __ATOMIC_ACQ_REL))
+		free(seg);
+}
+
+/* @Return: frozen node, whose range key is in, given where a walk to key
+ * ended: prev - the node below key (NULL - head), next - the node after it
+ * (NULL - none), or NULL if key isn't in a frozen range.
+ * Required locks: prev (or head), next (if exists)
+ */
+static inline frozen_node_t* frozen_at(node_t* prev, node_t* next, int key) {
+	frozen_node_t* frozen = as_frozen(prev);
+	if (frozen && key <= frozen->last_key)
+		return frozen;
+	frozen = as_frozen(next);
+	return frozen && frozen->node.key == key ? frozen : NULL;
+}
+
 /*------------------------- Static helper functions --------------------------*/
 
+//returns cache line aligned, uninitialized node, or NULL
+static inline node_t* alloc_node() {
+	void* new_node;
+	if (posix_memalign(&new_node, CACHE_LINE_SIZE, sizeof(node_t)))
+		return NULL;
+	return new_node;
+}
+
 static inline void init_node(node_t* new_node, int key, void* data) {
 	assert(new_node);
 	new_node->key = key;
+	new_node->flags = 0;
 	new_node->data = data;
 	new_node->next = NULL;
 	pthread_mutex_init(&new_node->lock, NULL);
 }
 
+/* list_compact moves nodes into blocks of NODE_BLOCK_SIZE bytes (a page),
+ * aligned to their size, so a node finds its block by its address. The
+ * 1st slot of a block holds its header, and the block is freed once the
+ * last of its nodes is. */
+#define NODE_BLOCK_SIZE 4096
+#define NODE_SLOT_SIZE ((sizeof(node_t) + CACHE_LINE_SIZE - 1) \
+		/ CACHE_LINE_SIZE * CACHE_LINE_SIZE)
+#define NODE_BLOCK_SLOTS ((int) (NODE_BLOCK_SIZE / NODE_SLOT_SIZE))
+
+typedef struct node_block_t {
+	int refs; // nodes in the block, and 1 while list_compact fills it
+} node_block_t;
+
+static inline node_block_t* block_of(node_t* node) {
+	return (node_block_t*) ((uintptr_t) node & ~(uintptr_t) (NODE_BLOCK_SIZE - 1));
+}
+
+static void release_block(node_block_t* block) {
+	if (!__atomic_sub_fetch(&block->refs, 1, __ATOMIC_ACQ_REL))
+		free(block);
+}
+
+//frees memory of a node allocated by the list
+static inline void free_node(node_t* node) {
+	if (node->flags & NODE_IN_BLOCK)
+		release_block(block_of(node));
+	else if (node->flags & NODE_FROZEN) {
+		release_seg(((frozen_node_t*) node)->seg);
+		free(node);
+	} else
+		free(node);
+}
+
+//data of key at slot of node (-1 - node isn't frozen, and has the key)
+static inline void** data_of(node_t* node, int slot) {
+	return slot >= 0 ? &((frozen_node_t*) node)->seg->datas[slot] : &node->data;
+}
+
+static int wait_for_readers(node_t* node);
+
 //node should be inaccessible for other threads and unlocked
 static inline void destroy_node(node_t* to_destroy) {
 	assert(to_destroy);
+	if (to_destroy->flags & NODE_INTRUSIVE)
+		return; // belongs to its owner
 	pthread_mutex_destroy(&to_destroy->lock);
-	free(to_destroy);
+	free_node(to_destroy);
+}
+
+/* Destroys a chain of nodes (linked through next, up to NULL), which no
+ * other thread can reach. A run of nodes of the same block (as list_compact
+ * leaves them) releases the block at once. */
+static void destroy_chain(node_t* current) {
+	while (current) {
+		if (!(current->flags & NODE_IN_BLOCK)) {
+			node_t* next = current->next;
+			destroy_node(current);
+			current = next;
+			continue;
+		}
+		node_block_t* block = block_of(current);
+		int run = 0;
+		do {
+			pthread_mutex_destroy(&current->lock);
+			current = current->next;
+			run++;
+		} while (current && (current->flags & NODE_IN_BLOCK)
+				&& block_of(current) == block);
+		if (!__atomic_sub_fetch(&block->refs, run, __ATOMIC_ACQ_REL))
+			free(block);
+	}
+}
+
+//adds keys of a node being linked to the filter and the index
+static void add_keys(linked_list_t* list, node_t* node) {
+	frozen_node_t* frozen = as_frozen(node);
+	if (frozen) {
+		__atomic_add_fetch(&list->frozen_nodes, 1, __ATOMIC_SEQ_CST);
+		for (int i = frozen->begin; list->bloom && i < frozen->end; i++)
+			if (!frozen_removed(frozen->seg, i))
+				bloom_add(list->bloom, frozen_key(frozen->seg, i));
+		return;
+	}
+	if (list->bloom)
+		bloom_add(list->bloom, node->key);
+	if (list->index)
+		index_add(list->index, node);
+}
+
+//removes keys of a node being unlinked from the index and the filter
+static void remove_keys(linked_list_t* list, node_t* node) {
+	frozen_node_t* frozen = as_frozen(node);
+	if (frozen) {
+		for (int i = frozen->begin; list->bloom && i < frozen->end; i++)
+			if (!frozen_removed(frozen->seg, i))
+				bloom_remove(list->bloom, frozen_key(frozen->seg, i));
+		__atomic_sub_fetch(&list->frozen_nodes, 1, __ATOMIC_SEQ_CST);
+		return;
+	}
+	if (list->index)
+		index_remove(list->index, node);
+	if (list->bloom)
+		bloom_remove(list->bloom, node->key);
 }
 
 //required locks: head
 static inline void insert_first(linked_list_t* list, node_t* new_node) {
 	assert(list && new_node);
+	add_keys(list, new_node);
 	new_node->next = list->head;
 	list->head = new_node;
 }
 
 //required locks: previous, previous->next
-static inline void insert_after(node_t* previous, node_t* new_node) {
-	assert(previous && new_node);
+static inline void insert_after(linked_list_t* list, node_t* previous,
+		node_t* new_node) {
+	assert(list && previous && new_node);
+	add_keys(list, new_node);
 	new_node->next = previous->next;
 	previous->next = new_node;
 }
 
-//required locks: head, 1st node
-static inline void remove_first(linked_list_t* list) {
+/* Removed nodes are unlinked under locks, but destroyed later, in batches,
+ * by the thread which removed them, so destroying (mutex destroy and free)
+ * doesn't lengthen critical sections. Hand-over-hand locking guarantees no
+ * other thread can reach an unlinked node, so no grace period is needed. */
+#define RETIRE_BATCH_SIZE 64
+
+typedef struct retire_list_t {
+	node_t* head;
+	int count;
+} retire_list_t;
+
+static __thread retire_list_t retired;
+static pthread_key_t retire_key;
+static pthread_once_t retire_key_once = PTHREAD_ONCE_INIT;
+
+static void reclaim_retired(void* retire_list) {
+	retire_list_t* to_reclaim = (retire_list_t*) retire_list;
+	node_t* current = to_reclaim->head;
+	while (current) {
+		node_t* next = current->next;
+		destroy_node(current);
+		current = next;
+	}
+	to_reclaim->head = NULL;
+	to_reclaim->count = 0;
+}
+
+static void create_retire_key() {
+	// reclaims what's left on the retire list when thread exits
+	pthread_key_create(&retire_key, reclaim_retired);
+}
+
+//node should be inaccessible for other threads and unlocked
+static void retire_node(node_t* to_retire) {
+	assert(to_retire);
+	if (to_retire->flags & NODE_INTRUSIVE)
+		return; // belongs to its owner, who may reuse it right away
+	if (!retired.head) {
+		pthread_once(&retire_key_once, create_retire_key);
+		pthread_setspecific(retire_key, &retired);
+	}
+	to_retire->next = retired.head;
+	retired.head = to_retire;
+	if (++retired.count >= RETIRE_BATCH_SIZE)
+		reclaim_retired(&retired);
+}
+
+/* Unlinks 1st node, once its readers left, and returns it. Removed node
+ * remains locked.
+ * Required locks: head, 1st node */
+static inline node_t* remove_first(linked_list_t* list) {
 	assert(list && list->head);
 	node_t* to_remove = list->head;
+	wait_for_readers(to_remove); // ops under lock policy waited already
 	list->head = to_remove->next;
-
-	pthread_mutex_unlock(&to_remove->lock);
-	destroy_node(to_remove);
+	remove_keys(list, to_remove);
+	return to_remove;
 }
 
-//required locks: previous, previous->next
-static inline void remove_after(node_t* previous) {
-	assert(previous && previous->next);
+/* Unlinks previous->next, once its readers left, and returns it. Removed
+ * node remains locked.
+ * Required locks: previous, previous->next */
+static inline node_t* remove_after(linked_list_t* list, node_t* previous) {
+	assert(list && previous && previous->next);
 	node_t* to_remove = previous->next;
+	wait_for_readers(to_remove); // ops under lock policy waited already
 	previous->next = to_remove->next;
+	remove_keys(list, to_remove);
+	return to_remove;
+}
+
+static void key_changing(linked_list_t* list, list_event_type_t type,
+		int key, void* data);
+
+/* Marks key at position i of frozen (not removed yet) removed.
+ * Required locks: frozen, and its readers left */
+static void frozen_drop(linked_list_t* list, frozen_node_t* frozen, int i) {
+	key_changing(list, LIST_EVENT_REMOVE, frozen_key(frozen->seg, i),
+			frozen->seg->datas[i]);
+	if (list->bloom)
+		bloom_remove(list->bloom, frozen_key(frozen->seg, i));
+	__atomic_fetch_or(&frozen->seg->removed[i / 8], 1 << (i % 8),
+			__ATOMIC_RELAXED);
+	frozen->live--;
+}
+
+/* Removes key at slot of frozen, once its readers left. If no key is left,
+ * and frozen is prev->next (or the 1st node, if prev is NULL), unlinks it,
+ * otherwise it stays linked, empty.
+ * Required locks: prev (or head), frozen (and prev->next)
+ * @Return: frozen, if it was unlinked (still locked), or NULL
+ */
+static node_t* frozen_remove(linked_list_t* list, node_t* prev,
+		frozen_node_t* frozen, int slot) {
+	wait_for_readers(&frozen->node); // ops under lock policy waited already
+	frozen_drop(list, frozen, slot);
+	if (frozen->live || (prev ? prev->next : list->head) != &frozen->node)
+		return NULL;
+	return prev ? remove_after(list, prev) : remove_first(list);
+}
+
+//whether split_frozen for key needs a spare view
+static int split_needs_view(const frozen_node_t* frozen, int key) {
+	if (key == frozen->node.key)
+		return 0; // the view just starts past key
+	int i = frozen_search(frozen, key);
+	i += i < frozen->end && frozen_key(frozen->seg, i) == key;
+	return i < frozen->end;
+}
+
+//number of keys at [begin, end) of seg, which weren't removed
+static int live_keys(const frozen_seg_t* seg, int begin, int end) {
+	int live = 0;
+	for (int i = begin; i < end; i++)
+		live += !frozen_removed(seg, i);
+	return live;
+}
+
+/* Chains new nodes for the keys at [begin, end) of frozen's segment, which
+ * weren't removed (there's at least one), in key order, the last one
+ * followed by next.
+ * @Return: the 1st node of the chain, or NULL if out of memory
+ */
+static node_t* thaw_keys(const frozen_node_t* frozen, int begin, int end,
+		node_t* next) {
+	node_t* chain = next;
+	for (int i = end - 1; i >= begin; i--) {
+		if (frozen_removed(frozen->seg, i))
+			continue;
+		node_t* node = alloc_node();
+		if (!node) {
+			while (chain != next) {
+				node = chain->next;
+				destroy_node(chain);
+				chain = node;
+			}
+			return NULL;
+		}
+		init_node(node, frozen_key(frozen->seg, i), frozen->seg->datas[i]);
+		node->next = chain;
+		chain = node;
+	}
+	return chain;
+}
+
+/* Adds the nodes of a chain from thaw_keys, once it's linked, to the index.
+ * Their keys are in the filter already. */
+static void index_thawed(linked_list_t* list, node_t* chain, node_t* next) {
+	for (; list->index && chain != next; chain = chain->next)
+		index_add(list->index, chain);
+}
 
-	pthread_mutex_unlock(&to_remove->lock);
-	destroy_node(to_remove);
+/* Turns frozen, with a single key left in its view, into a plain node of
+ * that key, in place.
+ * Required locks: frozen, and its readers left */
+static void thaw_in_place(linked_list_t* list, frozen_node_t* frozen) {
+	int i = frozen->begin;
+	while (frozen_removed(frozen->seg, i))
+		i++;
+	frozen_seg_t* seg = frozen->seg;
+	frozen->node.key = frozen_key(seg, i);
+	frozen->node.data = seg->datas[i];
+	__atomic_store_n(&frozen->node.flags, 0, __ATOMIC_RELEASE);
+	release_seg(seg);
+	if (list->index) // before it stops being counted, see find_indexed
+		index_add(list->index, &frozen->node);
+	__atomic_sub_fetch(&list->frozen_nodes, 1, __ATOMIC_SEQ_CST);
+}
+
+/* Makes room for key (not in list) in the range of frozen, so a node with
+ * key can be linked after prev: if key is the 1st key of the view, the view
+ * starts past it (frozen is unlinked, if that leaves it empty), otherwise
+ * the view ends below key, and keys above it go to spare (linked after
+ * frozen), see split_needs_view. A view left with less than
+ * FROZEN_THAW_KEYS keys goes back to nodes instead; but for the one below
+ * key, which stays prev, only if a single key is left, and thaw_below is
+ * set (the caller doesn't hold on to frozen for other keys) - list_freeze
+ * takes care of the rest.
+ * Takes spare (or NULL): it's freed, if not needed.
+ * Required locks: prev (or head), prev->next (if exists), and frozen
+ * @Return: frozen, if it was unlinked (still locked), or NULL
+ */
+static node_t* split_frozen(linked_list_t* list, node_t* prev,
+		frozen_node_t* frozen, int key, frozen_node_t* spare, int thaw_below) {
+	wait_for_readers(&frozen->node); // keys move; ops under lock policy waited
+	int i = frozen_search(frozen, key);
+	int above = i + (i < frozen->end && frozen_key(frozen->seg, i) == key);
+	int live_above = live_keys(frozen->seg, above, frozen->end);
+	node_t* next = frozen->node.next;
+	node_t* thawed = live_above && live_above < FROZEN_THAW_KEYS
+			? thaw_keys(frozen, above, frozen->end, next) : NULL;
+	if (key == frozen->node.key) { // frozen is prev->next
+		free(spare);
+		if (live_above && !thawed) {
+			set_view(frozen, above, frozen->end);
+			return NULL;
+		}
+		if (!thawed)
+			return prev ? remove_after(list, prev) : remove_first(list);
+		if (prev) // keys stay in the filter
+			prev->next = thawed;
+		else
+			list->head = thawed;
+		index_thawed(list, thawed, next);
+		__atomic_sub_fetch(&list->frozen_nodes, 1, __ATOMIC_SEQ_CST);
+		return &frozen->node;
+	}
+	if (thawed) { // no one else can reach them before frozen
+		frozen->node.next = thawed;
+		index_thawed(list, thawed, next);
+		free(spare);
+	} else if (live_above) {
+		assert(spare);
+		init_frozen(spare, frozen->seg, above, frozen->end);
+		spare->node.next = next;
+		frozen->node.next = &spare->node;
+		__atomic_add_fetch(&list->frozen_nodes, 1, __ATOMIC_SEQ_CST);
+	} else
+		free(spare);
+	set_view(frozen, frozen->begin, i);
+	if (thaw_below && frozen->live == 1)
+		thaw_in_place(list, frozen);
+	return NULL;
+}
+
+/* @Return:
+ *   0 - key is definitely not in list
+ *   1 - key may be in list (always, if list has no filter)
+ */
+static inline int may_contain(linked_list_t* list, int key) {
+	// the filter forgets keys moved by online split, so then it can't tell
+	return !list->bloom || bloom_may_contain(list->bloom, key)
+			|| __atomic_load_n(&list->resharding, __ATOMIC_SEQ_CST);
+}
+
+/* Online split states: RESHARD_CLAIMED - shards are being set up, nothing
+ * was moved yet; RESHARD_ACTIVE - keys below moved_below are in shards */
+#define RESHARD_CLAIMED 1
+#define RESHARD_ACTIVE 2
+
+/* Internal result of point ops: key was moved by online split, and the op
+ * should be redone on the shard (see moved_to) */
+#define MOVED (TIMED_OUT + 1)
+
+//shard of key range, which key belongs to. Required: RESHARD_ACTIVE
+static inline linked_list_t* shard_of(linked_list_t* list, int key) {
+	int lo = 0, hi = list->num_bounds; // shard - number of bounds <= key
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (list->shard_bounds[mid] <= key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return list->shards[lo];
+}
+
+/* @Return: shard which key was moved to by online split, or NULL if key is
+ * still in list. Once a key is moved, it stays so.
+ * To tell that an op may act on the key in list, call with the lock of the
+ * node before key (or head) held.
+ */
+static inline linked_list_t* moved_to(linked_list_t* list, int key) {
+	if (__atomic_load_n(&list->resharding, __ATOMIC_SEQ_CST) != RESHARD_ACTIVE
+			|| key >= __atomic_load_n(&list->moved_below, __ATOMIC_SEQ_CST))
+		return NULL;
+	return shard_of(list, key);
+}
+
+static inline int is_resharding(linked_list_t* list) {
+	return __atomic_load_n(&list->resharding, __ATOMIC_SEQ_CST) != 0;
+}
+
+/* Ops on the whole list (and batches) can't run on a list split online:
+ * their walks don't follow moved keys to the shards. So they count
+ * themselves in whole_ops, and list_split_online waits for the ones in
+ * progress before it moves any key.
+ * @Return: 1 - counted, 0 - list is being split online (nothing counted)
+ */
+static inline int enter_whole_op(linked_list_t* list) {
+	// either list_split_online waits for this op, or the op sees resharding
+	__atomic_add_fetch(&list->whole_ops, 1, __ATOMIC_SEQ_CST);
+	if (is_resharding(list)) {
+		__atomic_sub_fetch(&list->whole_ops, 1, __ATOMIC_SEQ_CST);
+		return 0;
+	}
+	return 1;
+}
+
+static inline void exit_whole_op(linked_list_t* list) {
+	__atomic_sub_fetch(&list->whole_ops, 1, __ATOMIC_SEQ_CST);
+}
+
+/* read_lock of cleanup_lock for ops on the whole list, see enter_whole_op
+ * @Return: 1 - locked, 0 - list is being destroyed or was split online
+ */
+static inline int read_lock_whole(linked_list_t* list) {
+	if (!read_lock(&list->cleanup_lock))
+		return 0;
+	if (!enter_whole_op(list)) {
+		read_unlock(&list->cleanup_lock);
+		return 0;
+	}
+	return 1;
+}
+
+static inline void read_unlock_whole(linked_list_t* list) {
+	exit_whole_op(list);
+	read_unlock(&list->cleanup_lock);
+}
+
+/*------------------------------- Lock policy --------------------------------*/
+
+/* How the calling thread's current op acquires list locks (mode_lock, head
+ * and node locks). Only the try/timed variants of point ops set a policy,
+ * for the duration of the call; otherwise (NULL) locks are awaited.
+ * When a lock isn't acquired, traversal releases the locks it holds, and
+ * the reason (BUSY or TIMED_OUT) is left in lock_failure. */
+typedef struct lock_policy_t {
+	int try_only;
+	const struct timespec* deadline; // absolute, CLOCK_REALTIME
+} lock_policy_t;
+
+static __thread const lock_policy_t* lock_policy;
+static __thread int lock_failure;
+
+static inline void set_lock_policy(const lock_policy_t* policy) {
+	lock_policy = policy;
+	lock_failure = SUCCESS;
+}
+
+static inline int policy_error(int err) {
+	lock_failure = err == ETIMEDOUT ? TIMED_OUT : err == EINVAL ? INVALID_ARG
+			: BUSY;
+	return 0;
+}
+
+/* Yields once more to those being waited for, unless the lock policy gives
+ * up waiting.
+ * @Return: 1 - waited, 0 - failed by policy (see lock_failure)
+ */
+static int keep_waiting() {
+	if (lock_policy) {
+		const struct timespec* deadline = lock_policy->deadline;
+		struct timespec now;
+		if (lock_policy->try_only)
+			return policy_error(EBUSY);
+		clock_gettime(CLOCK_REALTIME, &now);
+		if (now.tv_sec > deadline->tv_sec || (now.tv_sec == deadline->tv_sec
+				&& now.tv_nsec >= deadline->tv_nsec))
+			return policy_error(ETIMEDOUT);
+	}
+	sched_yield();
+	return 1;
+}
+
+/* Computes don't hold the node lock while compute_func runs: they register
+ * as readers of the node (in its flags) under the node lock (or mode_lock
+ * in coarse mode), and leave without any lock. So once a writer holds the
+ * node, no reader comes in, and before changing data or unlinking the node
+ * the writer only waits for the readers inside to leave.
+ * @Return: 1 - no readers, 0 - failed by policy (see lock_failure)
+ */
+static int wait_for_readers(node_t* node) {
+	while (__atomic_load_n(&node->flags, __ATOMIC_ACQUIRE) >= NODE_READER)
+		if (!keep_waiting())
+			return 0;
+	return 1;
+}
+
+//@Return: 1 - locked, 0 - failed by policy (see lock_failure)
+static inline int acquire(mutex_t* lock) {
+	if (!lock_policy) {
+		lock_traced(lock);
+		return 1;
+	}
+	int err = lock_policy->try_only ? pthread_mutex_trylock(lock)
+			: pthread_mutex_timedlock(lock, lock_policy->deadline);
+	return err ? policy_error(err) : 1;
+}
+
+//@Return: 1 - locked, 0 - failed by policy (see lock_failure)
+static inline int acquire_rw(pthread_rwlock_t* lock, int exclusive) {
+	int err;
+	if (!lock_policy)
+		err = exclusive ? pthread_rwlock_wrlock(lock) : pthread_rwlock_rdlock(lock);
+	else if (lock_policy->try_only)
+		err = exclusive ? pthread_rwlock_trywrlock(lock)
+				: pthread_rwlock_tryrdlock(lock);
+	else
+		err = exclusive ? pthread_rwlock_timedwrlock(lock, lock_policy->deadline)
+				: pthread_rwlock_timedrdlock(lock, lock_policy->deadline);
+	return err ? policy_error(err) : 1;
+}
+
+/*------------------------------- Change feed --------------------------------*/
+
+/* Ops note their changes while they hold the node locks, so changes of a
+ * key are numbered in their order, in a buffer of the calling thread, and
+ * deliver them to subscriptions once they released the node locks (see
+ * publish_events). Nothing is noted while list has no subscriptions. */
+typedef struct event_slot_t {
+	unsigned long seq;
+	list_event_t event;
+} event_slot_t;
+
+struct list_subscription_t {
+	int lo, hi;
+	void (*func)(const list_event_t* event, void* ctx);
+	void* ctx;
+	unsigned long lost;
+	/* Bounded queue (if func is NULL) for any number of producers and
+	 * consumers: slot of position pos is free for a producer when its seq is
+	 * pos, and full for a consumer when it's pos + 1 */
+	unsigned long enqueue_pos, dequeue_pos;
+	unsigned long mask;
+	event_slot_t slots[];
+};
+
+typedef struct noted_event_t {
+	linked_list_t* list;
+	list_event_t event;
+} noted_event_t;
+
+typedef struct event_buffer_t {
+	noted_event_t* events;
+	int count, capacity;
+} event_buffer_t;
+
+static __thread event_buffer_t noted;
+static pthread_key_t noted_key;
+static pthread_once_t noted_key_once = PTHREAD_ONCE_INIT;
+
+static void free_noted(void* buffer) {
+	free(((event_buffer_t*) buffer)->events);
+}
+
+static void create_noted_key() {
+	// frees the buffer when thread exits
+	pthread_key_create(&noted_key, free_noted);
+}
+
+//@Return: 1, or 0 if sub's queue is full
+static int enqueue_event(list_subscription_t* sub, const list_event_t* event) {
+	unsigned long pos = __atomic_load_n(&sub->enqueue_pos, __ATOMIC_RELAXED);
+	for (;;) {
+		event_slot_t* slot = &sub->slots[pos & sub->mask];
+		long diff = (long) (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+		if (diff < 0)
+			return 0;
+		if (!diff && __atomic_compare_exchange_n(&sub->enqueue_pos, &pos, pos + 1,
+				1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			slot->event = *event;
+			__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+			return 1;
+		}
+		if (diff)
+			pos = __atomic_load_n(&sub->enqueue_pos, __ATOMIC_RELAXED);
+	}
+}
+
+//@Return: 1, or 0 if sub's queue is empty
+static int dequeue_event(list_subscription_t* sub, list_event_t* event) {
+	unsigned long pos = __atomic_load_n(&sub->dequeue_pos, __ATOMIC_RELAXED);
+	for (;;) {
+		event_slot_t* slot = &sub->slots[pos & sub->mask];
+		long diff = (long) (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE)
+				- (pos + 1));
+		if (diff < 0)
+			return 0;
+		if (!diff && __atomic_compare_exchange_n(&sub->dequeue_pos, &pos, pos + 1,
+				1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			*event = slot->event;
+			__atomic_store_n(&slot->seq, pos + sub->mask + 1, __ATOMIC_RELEASE);
+			return 1;
+		}
+		if (diff)
+			pos = __atomic_load_n(&sub->dequeue_pos, __ATOMIC_RELAXED);
+	}
+}
+
+static void deliver(list_subscription_t* sub, const list_event_t* event) {
+	if (event->key < sub->lo || event->key > sub->hi)
+		return;
+	if (sub->func)
+		sub->func(event, sub->ctx);
+	else if (!enqueue_event(sub, event))
+		__atomic_add_fetch(&sub->lost, 1, __ATOMIC_RELAXED);
+}
+
+/* Notes a change of key, to be published by publish_events.
+ * Required locks: those of the change */
+static void note_event(linked_list_t* list, list_event_type_t type, int key,
+		void* data) {
+	if (!__atomic_load_n(&list->num_subs, __ATOMIC_RELAXED))
+		return;
+	list_event_t event = { __atomic_add_fetch(&list->event_seq, 1,
+			__ATOMIC_RELAXED), type, key, data };
+	if (noted.count == noted.capacity) {
+		int capacity = noted.capacity ? noted.capacity * 2 : 16;
+		noted_event_t* events = realloc(noted.events, capacity * sizeof(*events));
+		if (!events) { // can't be delivered: subscribers learn it was lost
+			pthread_rwlock_rdlock(&list->subs_lock);
+			for (int i = 0; i < list->num_subs; i++)
+				if (key >= list->subs[i]->lo && key <= list->subs[i]->hi)
+					__atomic_add_fetch(&list->subs[i]->lost, 1, __ATOMIC_RELAXED);
+			pthread_rwlock_unlock(&list->subs_lock);
+			return;
+		}
+		if (!noted.events) {
+			pthread_once(&noted_key_once, create_noted_key);
+			pthread_setspecific(noted_key, &noted);
+		}
+		noted.events = events;
+		noted.capacity = capacity;
+	}
+	noted.events[noted.count].list = list;
+	noted.events[noted.count++].event = event;
+}
+
+/* Delivers events noted by the calling thread. Callbacks may run list ops,
+ * which note (and publish) events of their own meanwhile.
+ * Required locks: cleanup_lock of the lists (as reader), and no node lock.
+ */
+static void publish_events() {
+	if (!noted.count)
+		return;
+	event_buffer_t events = noted;
+	noted.events = NULL;
+	noted.count = noted.capacity = 0;
+	const lock_policy_t* policy = lock_policy; // not for ops of callbacks
+	int failure = lock_failure;
+	lock_policy = NULL;
+	for (int i = 0; i < events.count;) {
+		linked_list_t* list = events.events[i].list;
+		pthread_rwlock_rdlock(&list->subs_lock);
+		for (; i < events.count && events.events[i].list == list; i++)
+			for (int s = 0; s < list->num_subs; s++)
+				deliver(list->subs[s], &events.events[i].event);
+		pthread_rwlock_unlock(&list->subs_lock);
+	}
+	lock_policy = policy;
+	lock_failure = failure;
+	if (!noted.events) { // reused by the next op
+		events.count = 0;
+		noted = events;
+	} else {
+		free(events.events);
+	}
+}
+
+/*-------------------------------- Read cache --------------------------------*/
+
+/* Per-thread cache of find/compute results (if config.read_cache): key,
+ * whether it's present, and its data. Entries are validated against the
+ * version of the key's stripe, which is bumped before any key of the stripe
+ * is inserted, removed or updated (under the locks of the change), so a hit
+ * returns what a walk would have found right then. Computes on cached data
+ * register as readers of the stripe, which writers wait for, as they wait
+ * for readers of a node. Entries hold data, not nodes, which may be freed
+ * meanwhile, and the id of their list, since its address may be reused. */
+#define CACHE_ENTRIES 256
+#define CACHE_STRIPES 1024
+#define CACHE_COUNTER_SLOTS 16
+
+typedef struct cache_stripe_t {
+	unsigned long version;
+	int readers;
+} cache_stripe_t;
+
+/* Hits and misses of threads, which share a slot, spread over slots so they
+ * rarely share a cache line */
+typedef struct cache_counters_t {
+	unsigned long hits, misses;
+} __attribute__((aligned(CACHE_LINE_SIZE))) cache_counters_t;
+
+typedef struct read_cache_t {
+	unsigned long id;
+	cache_counters_t counters[CACHE_COUNTER_SLOTS];
+	cache_stripe_t stripes[CACHE_STRIPES];
+} read_cache_t;
+
+typedef struct cache_entry_t {
+	unsigned long list_id; // 0 - empty
+	unsigned long version;
+	int key;
+	int present;
+	void* data;
+} cache_entry_t;
+
+static unsigned long next_cache_id;
+static int next_counter_slot;
+static __thread cache_entry_t* cached; // CACHE_ENTRIES, once used
+static __thread int counter_slot = -1;
+static pthread_key_t cached_key;
+static pthread_once_t cached_key_once = PTHREAD_ONCE_INIT;
+
+static void create_cached_key() {
+	// frees the cache when thread exits
+	pthread_key_create(&cached_key, free);
+}
+
+static read_cache_t* cache_alloc() {
+	read_cache_t* cache;
+	if (posix_memalign((void**) &cache, CACHE_LINE_SIZE, sizeof(*cache)))
+		return NULL;
+	memset(cache, 0, sizeof(*cache));
+	cache->id = __atomic_add_fetch(&next_cache_id, 1, __ATOMIC_RELAXED);
+	return cache;
+}
+
+static inline cache_stripe_t* stripe_of(read_cache_t* cache, int key) {
+	return &cache->stripes[((unsigned) key * 2654435761u) % CACHE_STRIPES];
+}
+
+static inline cache_entry_t* entry_of(read_cache_t* cache, int key) {
+	return &cached[((unsigned) key ^ (unsigned) cache->id * 40503u)
+			% CACHE_ENTRIES];
+}
+
+static void count_lookup(read_cache_t* cache, int hit) {
+	if (counter_slot < 0)
+		counter_slot = __atomic_fetch_add(&next_counter_slot, 1,
+				__ATOMIC_RELAXED) % CACHE_COUNTER_SLOTS;
+	cache_counters_t* counters = &cache->counters[counter_slot];
+	__atomic_add_fetch(hit ? &counters->hits : &counters->misses, 1,
+			__ATOMIC_RELAXED);
+}
+
+/* Looks key up in the calling thread's cache. If reader, a hit registers
+ * the caller as reader of the key's stripe, until cache_leave.
+ * @Return: the valid entry of key, or NULL (then *version is to be passed
+ * to cache_fill, once the op found what it looked for)
+ */
+static cache_entry_t* cache_lookup(linked_list_t* list, int key, int reader,
+		unsigned long* version) {
+	read_cache_t* cache = list->cache;
+	cache_stripe_t* stripe = stripe_of(cache, key);
+	cache_entry_t* entry = cached ? entry_of(cache, key) : NULL;
+	if (entry && entry->list_id == cache->id && entry->key == key) {
+		if (reader)
+			__atomic_add_fetch(&stripe->readers, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&stripe->version, __ATOMIC_SEQ_CST) == entry->version) {
+			count_lookup(cache, 1);
+			return entry;
+		}
+		if (reader)
+			__atomic_sub_fetch(&stripe->readers, 1, __ATOMIC_RELEASE);
+	}
+	*version = __atomic_load_n(&stripe->version, __ATOMIC_SEQ_CST);
+	count_lookup(cache, 0);
+	return NULL;
+}
+
+static inline void cache_leave(linked_list_t* list, int key) {
+	__atomic_sub_fetch(&stripe_of(list->cache, key)->readers, 1,
+			__ATOMIC_RELEASE);
+}
+
+/* Caches what an op found for key, if nothing in its stripe changed since
+ * cache_lookup read version */
+static void cache_fill(linked_list_t* list, int key, unsigned long version,
+		int present, void* data) {
+	if (!cached) {
+		if (!(cached = calloc(CACHE_ENTRIES, sizeof(*cached))))
+			return;
+		pthread_once(&cached_key_once, create_cached_key);
+		pthread_setspecific(cached_key, cached);
+	}
+	*entry_of(list->cache, key) = (cache_entry_t) { list->cache->id, version,
+			key, present, data };
+}
+
+/* Invalidates cached entries of key, and waits for computes on them (on
+ * any key of its stripe), as wait_for_readers does. Entries of key filled
+ * later can't hit before the change, which holds the locks they need.
+ * Required locks: those of the change of key
+ * @Return: 1 - no readers, 0 - failed by policy (see lock_failure)
+ */
+static int cache_invalidate(linked_list_t* list, int key) {
+	if (!list->cache)
+		return 1;
+	cache_stripe_t* stripe = stripe_of(list->cache, key);
+	__atomic_add_fetch(&stripe->version, 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&stripe->readers, __ATOMIC_SEQ_CST))
+		if (!keep_waiting())
+			return 0;
+	return 1;
+}
+
+//invalidates all cached entries (of keys which moved, not changed)
+static void cache_invalidate_all(linked_list_t* list) {
+	for (int i = 0; list->cache && i < CACHE_STRIPES; i++)
+		__atomic_add_fetch(&list->cache->stripes[i].version, 1, __ATOMIC_SEQ_CST);
+}
+
+/* Called before key is inserted, removed or its data changes to data (or,
+ * removed data), under the locks of the change. Ops under lock policy call
+ * cache_invalidate before, so they can still fail without changing key. */
+static void key_changing(linked_list_t* list, list_event_type_t type,
+		int key, void* data) {
+	if (!lock_policy)
+		cache_invalidate(list, key);
+	note_event(list, type, key, data);
+}
+
+/*---------------------------- Adaptive locking ------------------------------*/
+
+/* Mode is reconsidered every ADAPT_WINDOW point ops, by the share of ops
+ * which found their first lock contended (mode_lock in coarse mode,
+ * head_ptr_lock in fine mode). */
+#define ADAPT_WINDOW 1024
+#define SWITCH_TO_FINE_PERCENT 10
+#define SWITCH_TO_COARSE_PERCENT 2
+
+static inline void note_contention(linked_list_t* list) {
+	if (list->config.adaptive_locking)
+		__atomic_fetch_add(&list->window_contended, 1, __ATOMIC_RELAXED);
+}
+
+static void adapt_mode(linked_list_t* list) {
+	unsigned ops = __atomic_add_fetch(&list->window_ops, 1, __ATOMIC_RELAXED);
+	if (ops % ADAPT_WINDOW)
+		return;
+	unsigned percent = __atomic_exchange_n(&list->window_contended, 0,
+			__ATOMIC_RELAXED) * 100 / ADAPT_WINDOW;
+	int coarse = __atomic_load_n(&list->coarse, __ATOMIC_RELAXED);
+	if ((coarse && percent > SWITCH_TO_FINE_PERCENT)
+			|| (!coarse && percent < SWITCH_TO_COARSE_PERCENT)) {
+		// safe at any time: ops of both modes exclude each other by mode_lock
+		__atomic_store_n(&list->coarse, !coarse, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&list->mode_switches, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/* Enters a point op. Ops in coarse mode may skip node locks.
+ * Required locks: cleanup_lock (as reader).
+ * @Return:
+ *   1 - coarse mode, list is locked exclusively
+ *   0 - fine mode
+ *  -1 - mode_lock not acquired by lock policy (op isn't entered)
+ */
+static int enter_point_op(linked_list_t* list) {
+	if (!list->config.adaptive_locking)
+		return 0;
+	int coarse = __atomic_load_n(&list->coarse, __ATOMIC_RELAXED);
+	if (!coarse) {
+		if (!acquire_rw(&list->mode_lock, 0))
+			return -1;
+	} else if (pthread_rwlock_trywrlock(&list->mode_lock)) {
+		note_contention(list);
+		if (!acquire_rw(&list->mode_lock, 1))
+			return -1;
+	}
+	return coarse;
+}
+
+static void exit_point_op(linked_list_t* list) {
+	if (!list->config.adaptive_locking)
+		return;
+	pthread_rwlock_unlock(&list->mode_lock);
+	adapt_mode(list);
+}
+
+/* Bulk ops (traversing many nodes) always use fine mode */
+static void enter_bulk_op(linked_list_t* list) {
+	if (list->config.adaptive_locking)
+		pthread_rwlock_rdlock(&list->mode_lock);
+}
+
+static void exit_bulk_op(linked_list_t* list) {
+	if (list->config.adaptive_locking)
+		pthread_rwlock_unlock(&list->mode_lock);
+}
+
+/*--------------------------------- Traversal --------------------------------*/
+
+/* Starts hand-over-hand walk: locks head and (if exists) the 1st node,
+ * and returns their locks in prev_lock and next_lock.
+ * @Return: 1, or 0 if lock policy failed it (then nothing is locked)
+ */
+static int lock_head(linked_list_t* list, mutex_t** prev_lock,
+		mutex_t** next_lock) {
+	assert(list && prev_lock && next_lock);
+	*prev_lock = *next_lock = NULL;
+	if (pthread_mutex_trylock(&list->head_ptr_lock)) {
+		note_contention(list);
+		if (!acquire(&list->head_ptr_lock))
+			return 0;
+	}
+	*prev_lock = &list->head_ptr_lock;
+	if (list->head) {
+		if (!acquire(&list->head->lock)) {
+			pthread_mutex_unlock(&list->head_ptr_lock);
+			*prev_lock = NULL;
+			return 0;
+		}
+		*next_lock = &list->head->lock;
+		PREFETCH(list->head->next); // can't change while 1st node is locked
+	}
+	return 1;
+}
+
+/* Continues hand-over-hand walk from prev (NULL - head) up to the node
+ * closest below key, like closest_below_key. prev must be below key.
+ * Locks info: prev (or head) and the node after it (if exists) are locked
+ * upon calling, and the same holds for returned node upon return.
+ * If lock policy fails the walk, releases both locks, and returns NULL.
+ */
+static node_t* advance_below_key(linked_list_t* list, node_t* prev, int key,
+		mutex_t** prev_lock, mutex_t** next_lock) {
+	assert(list && prev_lock && next_lock);
+	node_t* current = prev ? prev->next : list->head;
+	while (current && current->key < key) {
+		pthread_mutex_unlock(*prev_lock);
+		prev = current;
+		*prev_lock = *next_lock;
+		current = current->next;
+		if (current) {
+			if (!acquire(&current->lock)) { //updated current, i.e. next node
+				pthread_mutex_unlock(*prev_lock);
+				*prev_lock = *next_lock = NULL;
+				return NULL;
+			}
+			PREFETCH(current->next);
+		}
+		*next_lock = current ? &current->lock : NULL;
+	}
+	return prev;
+}
+
+/* Return pointer to node v, where v.key < key. If for each node
+ * node.key >= key (i.e. node with key should be 1st), returns NULL
+ * (including the case when list is empty).
+ * Returns pointers to locks it acquired, in output variables prev_lock and next_lock.
+ *
+ * Uses hand-over-hand locking. Upon calling no node has to be locked.
+ * In coarse mode (see enter_point_op) doesn't lock anything, and both
+ * prev_lock and next_lock are NULL. The same if lock policy failed the walk
+ * (then lock_failure is set, and NULL is returned).
+ *
+ * Locks info (upon return):
+ * if returns last node - last node locked
+ * if returns NULL (only head is below key) - locks head and (if exists) the 1st node
+ * otherwise locks closest below and next to it
+ */
+static node_t* closest_below_key(linked_list_t* list, int key, int coarse,
+		mutex_t** prev_lock, mutex_t** next_lock) {
+	assert(list && prev_lock && next_lock);
+	*next_lock = NULL;
+	if (coarse) {
+		*prev_lock = NULL;
+		node_t *prev = NULL, *current = list->head;
+		while (current && current->key < key) {
+			prev = current;
+			current = current->next;
+			if (current)
+				PREFETCH(current->next);
+		}
+		return prev;
+	}
+	if (!lock_head(list, prev_lock, next_lock))
+		return NULL;
+	return advance_below_key(list, NULL, key, prev_lock, next_lock);
+}
+
+/* Returns with lock on found node only, or without any lock,
+ * if node with key not found. The lock held is returned in found_lock
+ * (NULL if none, which is also the case in coarse mode). If key is frozen,
+ * its frozen node is returned, and its position there in slot (else -1).
+ * Required locks - none.
+ */
+static node_t* find(linked_list_t* list, int key, int coarse,
+		mutex_t** found_lock, int* slot) {
+	assert(list && found_lock && slot);
+	node_t* found = NULL;
+	mutex_t *prev_lock, *next_lock;
+
+	*slot = -1;
+	node_t* prev = closest_below_key(list, key, coarse, &prev_lock, &next_lock);
+	if (lock_failure) {
+		*found_lock = NULL;
+		return NULL;
+	}
+	// prev (or head) and next (if exists) are locked now
+	node_t* next = prev ? prev->next : list->head;
+	frozen_node_t* frozen = frozen_at(prev, next, key);
+	if (frozen) {
+		*slot = frozen_find(frozen, key);
+		found = *slot >= 0 ? &frozen->node : NULL;
+	} else if (next && next->key == key) {
+		found = next;
+	}
+	*found_lock = !found ? NULL : found == prev ? prev_lock : next_lock;
+	if (prev_lock != *found_lock)
+		mutex_unlock_safe(prev_lock);
+	if (next_lock != *found_lock)
+		mutex_unlock_safe(next_lock);
+	return found;
+}
+
+/* Like find, but goes straight to the node through the hash index, if
+ * list has one. Walks the list only if the index can't tell.
+ */
+static node_t* find_indexed(linked_list_t* list, int key, int coarse,
+		mutex_t** found_lock, int* slot) {
+	assert(list && found_lock && slot);
+	if (list->index) {
+		int busy;
+		node_t* found = index_lookup(list->index, key, &busy);
+		*found_lock = found ? &found->lock : NULL;
+		*slot = -1;
+		if (found || (!busy
+				&& __atomic_load_n(&list->index->complete, __ATOMIC_RELAXED)
+				&& !is_resharding(list) // moved keys are unindexed
+				&& !__atomic_load_n(&list->frozen_nodes, __ATOMIC_SEQ_CST)))
+			return found;
+	}
+	return find(list, key, coarse, found_lock, slot);
+}
+
+static inline void list_init(linked_list_t* list) {
+	assert(list);
+	list->head = NULL;
+	list->size = 0;
+	list->bloom = NULL;
+	list->index = NULL;
+	list->cache = NULL;
+	list->coarse = 0;
+	list->window_ops = list->window_contended = 0;
+	list->mode_switches = 0;
+	list->resharding = 0;
+	list->moved_below = INT_MIN;
+	list->shards = NULL;
+	list->shard_bounds = NULL;
+	list->num_bounds = 0;
+	list->frozen_nodes = 0;
+	list->whole_ops = 0;
+	list->subs = NULL;
+	list->num_subs = 0;
+	list->event_seq = 0;
+	pthread_rwlock_init(&list->subs_lock, NULL);
+	pthread_rwlock_init(&list->mode_lock, NULL);
+	pthread_mutex_init(&list->size_lock, NULL);
+	pthread_mutex_init(&list->head_ptr_lock, NULL);
+	rc_lock_init(&list->cleanup_lock);
+}
+
+//required locks: cleanup_lock
+static void list_cleanup(linked_list_t* list) {
+	assert(list);
+	destroy_chain(list->head);
+	list->head = NULL;
+	pthread_mutex_destroy(&list->size_lock);
+	pthread_mutex_destroy(&list->head_ptr_lock);
+	pthread_rwlock_destroy(&list->mode_lock);
+	for (int i = 0; i < list->num_subs; i++)
+		free(list->subs[i]);
+	free(list->subs);
+	pthread_rwlock_destroy(&list->subs_lock);
+	free(list->bloom);
+	index_free(list->index);
+	free(list->cache);
+	free(list->shards);
+	free(list->shard_bounds);
+}
+
+//new lists have the same configuration as list
+static inline int alloc_and_init_list_array(linked_list_t* list, int n,
+		linked_list_t** arr) {
+	int i = 0;
+	for (; i < n; i++) {
+		arr[i] = list_alloc_config(&list->config);
+		if (arr[i] == NULL)
+			goto cleanup;
+	}
+	return SUCCESS;
+
+cleanup:
+	for (int j = 0; j < i; j++)
+		list_free(arr[j]);
+	return MEM_ERROR;
+}
+
+/*---------------------------- Parallel traversal ----------------------------*/
+
+/* Splits the list into at most n key ranges of about equal number of nodes.
+ * Writes lower bounds of all ranges, but the 1st, to bounds (which has room
+ * for n-1 keys). The list is only sampled: concurrent changes may skew sizes,
+ * and so do frozen nodes, whose keys all go to one range (some ranges may
+ * be empty then).
+ * Unless starts is NULL, writes the 1st node of each of these ranges to
+ * starts, and leaves the lock before it (in held) locked, so the node stays
+ * there. Empty ranges get NULL in both.
+ * Required: bulk op entered (see enter_bulk_op).
+ * @Return: number of ranges.
+ */
+static int sample_boundaries(linked_list_t* list, int n, int* bounds,
+		node_t** starts, mutex_t** held) {
+	assert(list && n > 0 && bounds);
+	pthread_mutex_lock(&list->size_lock);
+	int size = list->size;
+	pthread_mutex_unlock(&list->size_lock);
+	if (n > size)
+		n = size > 0 ? size : 1;
+
+	int found = 0, position = 0, next_bound = size / n;
+	mutex_t* prev_lock = &list->head_ptr_lock;
+	pthread_mutex_lock(prev_lock);
+	node_t* current = list->head;
+	while (current && found < n - 1) {
+		pthread_mutex_lock(&current->lock);
+		PREFETCH(current->next);
+		int keys = keys_in(current), first = found;
+		// bounds are node keys, so a frozen range is never split between ranges
+		while (found < n - 1 && position + keys > next_bound) {
+			if (starts) {
+				starts[found] = NULL;
+				held[found] = NULL;
+			}
+			bounds[found++] = current->key;
+			next_bound = (long long) size * (found + 1) / n;
+		}
+		if (starts && found > first) { // ranges before the last one are empty
+			starts[found - 1] = current;
+			held[found - 1] = prev_lock;
+		} else {
+			pthread_mutex_unlock(prev_lock);
+		}
+		prev_lock = &current->lock;
+		position += keys;
+		current = current->next;
+	}
+	pthread_mutex_unlock(prev_lock);
+	return found + 1;
+}
+
+//visits keys of locked frozen, which are in segment
+static void visit_frozen(segment_t* segment, frozen_node_t* frozen) {
+	for (int i = frozen_search(frozen, segment->lo); i < frozen->end; i++) {
+		int key = frozen_key(frozen->seg, i);
+		if (segment->has_hi && key >= segment->hi)
+			break;
+		if (!frozen_removed(frozen->seg, i))
+			segment->visit(segment, key, frozen->seg->datas[i]);
+	}
+}
+
+/* Visits every node with key in segment, in key order, using hand-over-hand
+ * locking. The walk starts at segment->start, if set, else walks from the
+ * head, locking in turn every node below the segment, too.
+ * Required locks - none.
+ */
+static void* visit_segment(void* arg) {
+	assert(arg);
+	segment_t* segment = (segment_t*) arg;
+	linked_list_t* list = segment->list;
+	mutex_t *prev_lock = NULL, *next_lock;
+	node_t *prev = NULL, *current = segment->start;
+	if (segment->has_hi && segment->hi <= segment->lo)
+		return NULL; // empty, see sample_boundaries
+
+	enter_bulk_op(list);
+	if (current) {
+		pthread_mutex_lock(&current->lock);
+		next_lock = &current->lock;
+		__atomic_store_n(&segment->started, 1, __ATOMIC_RELEASE);
+	} else {
+		prev = closest_below_key(list, segment->lo, 0, &prev_lock, &next_lock);
+		current = prev ? prev->next : list->head; // locked, if exists
+	}
+	frozen_node_t* frozen = as_frozen(prev);
+	if (frozen && segment->lo <= frozen->last_key) { // lo is in its range
+		if (segment->func)
+			wait_for_readers(prev);
+		visit_frozen(segment, frozen);
+	}
+	while (current && (!segment->has_hi || current->key < segment->hi)) {
+		if (segment->func) // for_each callbacks never overlap computes
+			wait_for_readers(current);
+		if ((frozen = as_frozen(current)))
+			visit_frozen(segment, frozen);
+		else
+			segment->visit(segment, current->key, current->data);
+		if (current->next)
+			pthread_mutex_lock(&current->next->lock);
+		mutex_unlock_safe(prev_lock);
+		prev_lock = &current->lock;
+		current = current->next;
+		next_lock = current ? &current->lock : NULL;
+	}
+	mutex_unlock_safe(prev_lock);
+	mutex_unlock_safe(next_lock);
+	exit_bulk_op(list);
+	return NULL;
+}
+
+static void visit_for_each(segment_t* segment, int key, void* data) {
+	segment->func(key, data, segment->ctx);
+}
+
+static void visit_reduce(segment_t* segment, int key, void* data) {
+	segment->acc = segment->reduce_func(segment->acc, key, data, segment->ctx);
+}
+
+/* Runs segment->visit over the whole list, on up to num_threads threads.
+ * Each thread starts at the 1st node of its segment, found by the sampling
+ * walk: the node before it stays locked until the thread locks it, so
+ * threads don't walk from the head (past nodes locked by other threads,
+ * while their callbacks run).
+ * template - segment with callbacks and initial accumulator filled.
+ * On success, segments holds *num_segments visited segments (to be freed).
+ * Required locks: cleanup_lock (as reader).
+ */
+static int visit_in_parallel(linked_list_t* list, int num_threads,
+		const segment_t* template, segment_t** segments, int* num_segments) {
+	int* bounds;
+	node_t** starts;
+	mutex_t** held;
+	pthread_t* threads;
+	MALLOC_N_ORELSE(bounds, num_threads, return MEM_ERROR);
+	MALLOC_N_ORELSE(starts, num_threads, free(bounds); return MEM_ERROR);
+	MALLOC_N_ORELSE(held, num_threads, free(starts); free(bounds);
+			return MEM_ERROR);
+	MALLOC_N_ORELSE(threads, num_threads, free(held); free(starts);
+			free(bounds); return MEM_ERROR);
+	MALLOC_N_ORELSE(*segments, num_threads, free(threads); free(held);
+			free(starts); free(bounds); return MEM_ERROR);
+
+	enter_bulk_op(list); // so held locks keep their nodes until handed over
+	int n = sample_boundaries(list, num_threads, bounds, starts, held);
+	for (int i = 0; i < n; i++) {
+		segment_t* segment = &(*segments)[i];
+		*segment = *template;
+		segment->list = list;
+		segment->lo = i > 0 ? bounds[i - 1] : INT_MIN;
+		segment->has_hi = i < n - 1;
+		segment->hi = segment->has_hi ? bounds[i] : 0;
+		segment->start = i > 0 ? starts[i - 1] : NULL;
+		segment->started = 0;
+	}
+	// the 1st segment is visited by this thread
+	int spawned = 1;
+	for (; spawned < n; spawned++)
+		if (pthread_create(&threads[spawned], NULL, visit_segment,
+				&(*segments)[spawned]))
+			break;
+	for (int i = spawned; i < n; i++) // visited here later, from the head
+		(*segments)[i].start = NULL;
+	// releases each held lock once its thread locked the start node; in any
+	// order, since a thread may wait for an op waiting for a later lock
+	for (int waiting = 1; waiting;) {
+		waiting = 0;
+		for (int i = 1; i < n; i++) {
+			if (!held[i - 1])
+				continue;
+			if (i < spawned && !__atomic_load_n(&(*segments)[i].started,
+					__ATOMIC_ACQUIRE)) {
+				waiting = 1;
+				continue;
+			}
+			pthread_mutex_unlock(held[i - 1]);
+			held[i - 1] = NULL;
+		}
+		if (waiting)
+			sched_yield();
+	}
+	exit_bulk_op(list);
+	visit_segment(&(*segments)[0]);
+	for (int i = spawned; i < n; i++) // couldn't create thread - do it here
+		visit_segment(&(*segments)[i]);
+	for (int i = 1; i < spawned; i++)
+		pthread_join(threads[i], NULL);
+
+	*num_segments = n;
+	free(threads);
+	free(held);
+	free(starts);
+	free(bounds);
+	return SUCCESS;
+}
+
+/*------------------------------- Bulk removal -------------------------------*/
+
+/* Data of frozen keys removed by list_remove_if, for free_data */
+typedef struct data_array_t {
+	void** datas;
+	int count, capacity;
+	int failed; // couldn't grow
+} data_array_t;
+
+/* Removes keys of frozen, for which pred holds. Their data is added to kept
+ * (if not NULL), which first grows to fit every key of frozen: if it can't,
+ * nothing is removed, and kept->failed is set.
+ * Required locks: frozen
+ * @Return: number of removed keys.
+ */
+static int drop_frozen_if(linked_list_t* list, frozen_node_t* frozen,
+		int (*pred)(int key, void* data, void* ctx), void* ctx,
+		data_array_t* kept) {
+	if (kept && kept->count + frozen->live > kept->capacity) {
+		int capacity = kept->capacity * 2;
+		if (capacity < kept->count + frozen->live)
+			capacity = kept->count + frozen->live;
+		void** datas = realloc(kept->datas, capacity * sizeof(*datas));
+		if (!datas) {
+			kept->failed = 1;
+			return 0;
+		}
+		kept->datas = datas;
+		kept->capacity = capacity;
+	}
+	int count = 0;
+	for (int i = frozen->begin; i < frozen->end; i++) {
+		void* data = frozen->seg->datas[i];
+		if (frozen_removed(frozen->seg, i)
+				|| !pred(frozen_key(frozen->seg, i), data, ctx))
+			continue;
+		wait_for_readers(&frozen->node);
+		frozen_drop(list, frozen, i);
+		if (kept)
+			kept->datas[kept->count++] = data;
+		count++;
+	}
+	return count;
+}
+
+/* Unlinks every node, for which pred holds, in one hand-over-hand pass, and
+ * removes such keys of frozen nodes (see drop_frozen_if), unlinking frozen
+ * nodes left empty.
+ * Unlinked nodes are chained through their next pointers (in reverse order)
+ * into *removed, so they can be destroyed after all locks are released.
+ * Required locks - none.
+ * @Return: number of removed keys.
+ */
+static int unlink_if(linked_list_t* list,
+		int (*pred)(int key, void* data, void* ctx), void* ctx,
+		node_t** removed, data_array_t* kept) {
+	assert(list && pred && removed);
+	int count = 0;
+	node_t *prev = NULL, *current;
+	mutex_t* prev_lock = &list->head_ptr_lock;
+
+	enter_bulk_op(list);
+	pthread_mutex_lock(prev_lock);
+	current = list->head;
+	if (current)
+		pthread_mutex_lock(&current->lock);
+	while (current) {
+		node_t* next = current->next;
+		if (next) {
+			pthread_mutex_lock(&next->lock);
+			PREFETCH(next->next);
+		}
+		frozen_node_t* frozen = as_frozen(current);
+		int unlink;
+		if (frozen) {
+			count += drop_frozen_if(list, frozen, pred, ctx, kept);
+			unlink = !frozen->live;
+		} else {
+			unlink = pred(current->key, current->data, ctx);
+			count += unlink;
+			if (unlink)
+				key_changing(list, LIST_EVENT_REMOVE, current->key, current->data);
+		}
+		if (unlink) {
+			if (!prev)  // head_lock and 1st node are locked
+				remove_first(list);
+			else		// prev and current are locked
+				remove_after(list, prev);
+			//unreachable now, and no one waits for it, since prev is locked
+			current->next = *removed;
+			*removed = current;
+			pthread_mutex_unlock(&current->lock);
+		} else {
+			pthread_mutex_unlock(prev_lock);
+			prev = current;
+			prev_lock = &current->lock;
+		}
+		current = next;
+	}
+	pthread_mutex_unlock(prev_lock);
+	exit_bulk_op(list);
+	return count;
+}
+
+/*------------------------------ Priority queue ------------------------------*/
+
+static __thread unsigned spray_seed;
+
+/* Removes up to count keys of frozen, from its skip-th key on, and writes
+ * them and their data to keys and datas (if not NULL).
+ * Required locks: frozen
+ * @Return: number of removed keys.
+ */
+static int pop_frozen(linked_list_t* list, frozen_node_t* frozen, int skip,
+		int count, int* keys, void** datas) {
+	int popped = 0;
+	for (int i = frozen->begin; i < frozen->end && popped < count; i++) {
+		if (frozen_removed(frozen->seg, i) || skip-- > 0)
+			continue;
+		wait_for_readers(&frozen->node);
+		if (keys)
+			keys[popped] = frozen_key(frozen->seg, i);
+		if (datas)
+			datas[popped] = frozen->seg->datas[i];
+		frozen_drop(list, frozen, i);
+		popped++;
+	}
+	return popped;
+}
+
+/* Unlinks up to count consecutive keys, starting from the key at position
+ * (0 - the 1st key). If list is shorter, starts from the last key. Frozen
+ * nodes lose their keys, and are unlinked once they're left empty.
+ * Keys and data of unlinked nodes are written to keys and datas (if not NULL).
+ * Required locks: cleanup_lock (as reader).
+ * @Return: number of unlinked keys.
+ */
+static int pop_at(linked_list_t* list, int position, int count, int* keys,
+		void** datas) {
+	mutex_t *prev_lock = NULL, *next_lock = NULL;
+	node_t *prev = NULL, *removed = NULL;
+	int popped = 0;
+	int coarse = enter_point_op(list);
+	if (!coarse)
+		lock_head(list, &prev_lock, &next_lock);
+
+	node_t* current = list->head; // locked, if exists
+	int skip = position; // keys of current to skip
+	while (current && current->next && skip >= keys_in(current)) {
+		node_t* next = current->next;
+		skip -= keys_in(current);
+		if (!coarse) {
+			pthread_mutex_lock(&next->lock);
+			pthread_mutex_unlock(prev_lock);
+			prev_lock = next_lock;
+			next_lock = &next->lock;
+		}
+		prev = current;
+		current = next;
+	}
+	if (current && skip >= keys_in(current)) // list is shorter
+		skip = keys_in(current) ? keys_in(current) - 1 : 0;
+	while (current && popped < count) {
+		node_t* next = current->next;
+		if (next && !coarse)
+			pthread_mutex_lock(&next->lock);
+		frozen_node_t* frozen = as_frozen(current);
+		if (frozen)
+			popped += pop_frozen(list, frozen, skip, count - popped,
+					keys ? keys + popped : NULL, datas ? datas + popped : NULL);
+		skip = 0;
+		if (frozen && frozen->live) { // popped what was asked
+			mutex_unlock_safe(prev_lock);
+			prev_lock = next_lock;
+			next_lock = next && !coarse ? &next->lock : NULL;
+			prev = current;
+			current = next;
+			continue;
+		}
+		if (!frozen)
+			key_changing(list, LIST_EVENT_REMOVE, current->key, current->data);
+		if (!prev)  // head_lock and 1st node are locked
+			remove_first(list);
+		else		// prev and current are locked
+			remove_after(list, prev);
+		if (!frozen) {
+			if (keys)
+				keys[popped] = current->key;
+			if (datas)
+				datas[popped] = current->data;
+			popped++;
+		}
+		mutex_unlock_safe(next_lock); // current's lock
+		next_lock = next && !coarse ? &next->lock : NULL;
+		current->next = removed; // unreachable now
+		removed = current;
+		current = next;
+	}
+	mutex_unlock_safe(prev_lock);
+	mutex_unlock_safe(next_lock);
+	exit_point_op(list);
+	publish_events();
+
+	while (removed) {
+		node_t* next = removed->next;
+		retire_node(removed);
+		removed = next;
+	}
+	if (popped) {
+		pthread_mutex_lock(&list->size_lock);
+		list->size -= popped;
+		pthread_mutex_unlock(&list->size_lock);
+	}
+	return popped;
+}
+
+/*------------------------------ Batch coalescing ----------------------------*/
+
+/* Orders ops by key, and ops with the same key by their position in the batch */
+static int compare_ops_by_key(const void* a, const void* b) {
+	const op_t *op_a = *(op_t* const*) a, *op_b = *(op_t* const*) b;
+	if (op_a->key != op_b->key)
+		return op_a->key < op_b->key ? -1 : 1;
+	return op_a < op_b ? -1 : op_a > op_b;
+}
+
+static int group_may_insert(op_t** ops, int num_ops) {
+	for (int i = 0; i < num_ops; i++)
+		if (ops[i]->op == INSERT || ops[i]->op == UPSERT
+				|| ops[i]->op == GET_OR_INSERT)
+			return 1;
+	return 0;
+}
+
+/* Applies op to the state of its key, as it would be after all previous ops
+ * of the same key: present - whether key is in list, data - its data if so,
+ * intrusive - whether it's still the intrusive node found in the list, whose
+ * data is its container, so ops can't change it (INVALID_ARG).
+ * Doesn't touch the list, only the state and op->result.
+ * can_insert - whether there's a preallocated node for the net insertion.
+ */
+static void coalesce_op(op_t* op, int* present, void** data, int* intrusive,
+		int can_insert) {
+	switch (op->op) {
+	case INSERT:
+		if (*present) {
+			op->result = ALREADY_IN_LIST;
+		} else if (!can_insert) {
+			op->result = MEM_ERROR;
+		} else {
+			*present = 1;
+			*data = op->data;
+			op->result = SUCCESS;
+		}
+		break;
+	case REMOVE:
+		op->result = *present ? SUCCESS : NOT_FOUND;
+		*present = *intrusive = 0;
+		break;
+	case CONTAINS:
+		op->result = *present;
+		break;
+	case UPDATE:
+		op->result = !*present ? NOT_FOUND : *intrusive ? INVALID_ARG : SUCCESS;
+		if (op->result == SUCCESS)
+			*data = op->data;
+		break;
+	case COMPUTE: // op->data is the result pointer, like in list_compute
+		if (!op->data || !op->compute_func)
+			op->result = NULL_ARG;
+		else if (!*present)
+			op->result = NOT_FOUND;
+		else {
+			*(int*) op->data = op->compute_func(*data);
+			op->result = SUCCESS;
+		}
+		break;
+	case UPSERT:
+		if (!*present && !can_insert) {
+			op->result = MEM_ERROR;
+			break;
+		}
+		if (*intrusive) {
+			op->result = INVALID_ARG;
+			break;
+		}
+		*present = 1;
+		*data = op->data;
+		op->result = SUCCESS;
+		break;
+	case REMOVE_GET: // op->data is set to the removed data
+		op->result = *present ? SUCCESS : NOT_FOUND;
+		if (*present)
+			op->data = *data;
+		*present = *intrusive = 0;
+		break;
+	case CAS:
+		if (!*present)
+			op->result = NOT_FOUND;
+		else if (*data != op->expected)
+			op->result = DATA_MISMATCH;
+		else if (*intrusive)
+			op->result = INVALID_ARG;
+		else {
+			*data = op->data;
+			op->result = SUCCESS;
+		}
+		break;
+	case GET_OR_INSERT: // op->data is set to the data in list
+		if (*present) {
+			op->data = *data;
+			op->result = ALREADY_IN_LIST;
+		} else if (!can_insert) {
+			op->result = MEM_ERROR;
+		} else {
+			*present = 1;
+			*data = op->data;
+			op->result = SUCCESS;
+		}
+		break;
+	default:
+		assert(0);
+	}
+}
+
+//fails every op of a group with the lock policy's failure
+static void fail_key_group(op_t** ops, int num_ops) {
+	for (int i = 0; i < num_ops; i++)
+		ops[i]->result = lock_failure;
+}
+
+/* Replays ops of one key against the node after prev (1st node, if prev is
+ * NULL), or the frozen node of key, and applies only their net effect to the
+ * list (at most one insertion, removal or data change - or, for an intrusive
+ * node removed and inserted again, its removal and a new node's insertion).
+ * The whole group is linearized here. Under lock policy, it may fail as a
+ * whole (see fail_key_group), before anything changes.
+ * new_node - preallocated node (or NULL), set to NULL if it was linked.
+ * removed - set to the unlinked node (still locked), or NULL.
+ * Required locks: prev (or head), prev->next (if exists).
+ * @Return: change in list size.
+ */
+static int apply_key_group(linked_list_t* list, node_t* prev, op_t** ops,
+		int num_ops, node_t** new_node, node_t** removed) {
+	assert(list && ops && num_ops > 0 && new_node && removed);
+	int key = ops[0]->key;
+	node_t* found = prev ? prev->next : list->head; // locked, if exists
+	frozen_node_t* frozen = frozen_at(prev, found, key);
+	frozen_node_t* spare = NULL;
+	int slot = frozen ? frozen_find(frozen, key) : -1;
+	if (frozen)
+		found = slot >= 0 ? &frozen->node : NULL;
+	else if (found && found->key != key)
+		found = NULL;
+
+	int present = found != NULL;
+	void* data = found ? *data_of(found, slot) : NULL;
+	int was_intrusive = found
+			&& __atomic_load_n(&found->flags, __ATOMIC_RELAXED) & NODE_INTRUSIVE;
+	int intrusive = was_intrusive;
+	int can_insert = *new_node != NULL;
+	if (can_insert && frozen && !found && split_needs_view(frozen, key))
+		can_insert = (spare = alloc_frozen()) != NULL; // rare, see link_node
+	for (int i = 0; i < num_ops; i++)
+		coalesce_op(ops[i], &present, &data, &intrusive, can_insert);
+
+	*removed = NULL;
+	node_t* waited = found ? found : frozen ? &frozen->node : NULL;
+	if (lock_policy && (present != (found != NULL) || intrusive != was_intrusive
+			|| (found && data != *data_of(found, slot)))
+			&& ((waited && !wait_for_readers(waited))
+			|| !cache_invalidate(list, key))) {
+		free(spare);
+		fail_key_group(ops, num_ops);
+		return 0;
+	}
+	if (found && !present) {
+		if (frozen)
+			*removed = frozen_remove(list, prev, frozen, slot);
+		else {
+			key_changing(list, LIST_EVENT_REMOVE, key, found->data);
+			if (!prev)  // head_lock and 1st node are locked
+				*removed = remove_first(list);
+			else		// prev and prev->next are locked
+				*removed = remove_after(list, prev);
+		}
+		return -1;
+	}
+	int size_diff = 0;
+	if (was_intrusive && !intrusive) { // inserted again, but the hook goes
+		key_changing(list, LIST_EVENT_REMOVE, key, found->data);
+		*removed = prev ? remove_after(list, prev) : remove_first(list);
+		found = NULL;
+		size_diff = -1;
+	}
+	if (!found && present) {
+		if (frozen)
+			*removed = split_frozen(list, prev, frozen, key, spare, 1);
+		key_changing(list, LIST_EVENT_INSERT, key, data);
+		init_node(*new_node, key, data);
+		if (!prev)
+			insert_first(list, *new_node);
+		else
+			insert_after(list, prev, *new_node);
+		*new_node = NULL;
+		return size_diff + 1;
+	}
+	free(spare);
+	if (found && *data_of(found, slot) != data) {
+		wait_for_readers(found);
+		key_changing(list, LIST_EVENT_UPDATE, key, data);
+		*data_of(found, slot) = data;
+	}
+	return 0;
+}
+
+/* Executes all ops of one key as a single list operation: positions once,
+ * and applies the ops with apply_key_group.
+ */
+static void run_key_group(linked_list_t* list, op_t** ops, int num_ops) {
+	assert(list && ops && num_ops > 0);
+	int key = ops[0]->key;
+	if (!read_lock(&list->cleanup_lock)) {
+		for (int i = 0; i < num_ops; i++)
+			ops[i]->result = CLEANUP_PENDING;
+		return;
+	}
+	linked_list_t* shard = moved_to(list, key);
+	if (shard) {
+		read_unlock(&list->cleanup_lock);
+		run_key_group(shard, ops, num_ops);
+		return;
+	}
+
+	int may_insert = group_may_insert(ops, num_ops);
+	if (!may_insert && !may_contain(list, key)) {
+		// definitely not in list, and will stay so: no need to lock anything
+		int present = 0, intrusive = 0;
+		void* data = NULL;
+		for (int i = 0; i < num_ops; i++)
+			coalesce_op(ops[i], &present, &data, &intrusive, 0);
+		read_unlock(&list->cleanup_lock);
+		return;
+	}
+	// if allocation fails, inserts of the group will fail with MEM_ERROR
+	node_t* new_node = may_insert ? alloc_node() : NULL;
+
+	mutex_t *prev_lock, *next_lock;
+	node_t* removed = NULL;
+	int size_diff = 0;
+	int coarse = enter_point_op(list);
+	if (coarse < 0) {
+		fail_key_group(ops, num_ops);
+		free(new_node);
+		read_unlock(&list->cleanup_lock);
+		return;
+	}
+	node_t* prev = closest_below_key(list, key, coarse, &prev_lock, &next_lock);
+	shard = lock_failure ? NULL : moved_to(list, key);
+	if (lock_failure)
+		fail_key_group(ops, num_ops);
+	else if (!shard)
+		size_diff = apply_key_group(list, prev, ops, num_ops, &new_node,
+				&removed);
+	mutex_unlock_safe(prev_lock);
+	mutex_unlock_safe(next_lock);
+	exit_point_op(list);
+	publish_events();
+	if (removed)
+		retire_node(removed);
+
+	if (size_diff) {
+		pthread_mutex_lock(&list->size_lock);
+		list->size += size_diff;
+		pthread_mutex_unlock(&list->size_lock);
+	}
+	free(new_node); // wasn't initialized, if wasn't linked
+	read_unlock(&list->cleanup_lock);
+	if (shard)
+		run_key_group(shard, ops, num_ops);
+}
+
+//runs a single op in one traversal, see run_key_group
+static int run_single_op(linked_list_t* list, op_t* op) {
+	run_key_group(list, &op, 1);
+	return op->result;
+}
+
+/*---------------------- Key range partitioned batch -------------------------*/
+
+/* Every batch worker walks the list from the head to its key range, so
+ * workers lock the head in descending order of ranges: a worker never has
+ * to follow behind another worker, which is already sweeping its range. */
+static void wait_for_head_turn(batch_start_t* start, int worker) {
+	pthread_mutex_lock(&start->lock);
+	while (start->next_worker > worker)
+		pthread_cond_wait(&start->turn, &start->lock);
+	pthread_mutex_unlock(&start->lock);
+}
+
+static void pass_head_turn(batch_start_t* start, int worker) {
+	pthread_mutex_lock(&start->lock);
+	start->next_worker = worker - 1;
+	pthread_cond_broadcast(&start->turn);
+	pthread_mutex_unlock(&start->lock);
+}
+
+/* Preallocates a node for every group which may insert, chained by next.
+ * If allocation fails, some groups will get no node (and fail to insert). */
+static node_t* alloc_spare_nodes(op_t** ops, int num_ops) {
+	node_t* spare = NULL;
+	for (int first = 0, i = 1; i <= num_ops; i++) {
+		if (i < num_ops && ops[i]->key == ops[first]->key)
+			continue;
+		node_t* new_node;
+		if (group_may_insert(&ops[first], i - first) && (new_node = alloc_node())) {
+			new_node->next = spare;
+			spare = new_node;
+		}
+		first = i;
+	}
+	return spare;
+}
+
+/* Applies all ops of the worker (sorted by key) in a single hand-over-hand
+ * sweep, from the 1st key of its range to the last one.
+ * Required locks: cleanup_lock (as reader).
+ */
+static int sweep_key_range(linked_list_t* list, op_t** ops, int num_ops,
+		batch_start_t* start, int worker) {
+	node_t* spare = alloc_spare_nodes(ops, num_ops);
+	mutex_t *prev_lock, *next_lock;
+	node_t* prev = NULL;
+	int size_diff = 0;
+
+	enter_bulk_op(list);
+	wait_for_head_turn(start, worker);
+	lock_head(list, &prev_lock, &next_lock);
+	pass_head_turn(start, worker);
+
+	for (int first = 0, i = 1; i <= num_ops; i++) {
+		if (i < num_ops && ops[i]->key == ops[first]->key)
+			continue;
+		op_t** group = &ops[first];
+		int group_size = i - first;
+		first = i;
+
+		prev = advance_below_key(list, prev, group[0]->key, &prev_lock, &next_lock);
+		node_t *new_node = NULL, *removed;
+		if (spare && group_may_insert(group, group_size)) {
+			new_node = spare;
+			spare = spare->next;
+		}
+		size_diff += apply_key_group(list, prev, group, group_size, &new_node,
+				&removed);
+		if (new_node) { // wasn't needed
+			new_node->next = spare;
+			spare = new_node;
+		}
+		// restore the lock on prev->next, if the group relinked it
+		node_t* next = prev ? prev->next : list->head;
+		if ((next ? &next->lock : NULL) != next_lock) {
+			if (next) // inserted (unreachable but through prev) or removed->next
+				pthread_mutex_lock(&next->lock);
+			mutex_unlock_safe(next_lock);
+			next_lock = next ? &next->lock : NULL;
+		}
+		if (removed)
+			retire_node(removed);
+	}
+	mutex_unlock_safe(prev_lock);
+	mutex_unlock_safe(next_lock);
+	exit_bulk_op(list);
+	publish_events();
+
+	while (spare) { // not initialized
+		node_t* next = spare->next;
+		free(spare);
+		spare = next;
+	}
+	return size_diff;
+}
+
+/*------------------------------- Transactions -------------------------------*/
+
+/* Ops of one key in a transaction, and their net effect on the key */
+typedef struct txn_group_t {
+	op_t** ops;
+	int num_ops;
+	node_t* prev; // node below key (NULL - head), locked till the end
+	node_t* found; // node with key, or NULL
+	frozen_node_t* frozen; // whose range key is in, or NULL
+	int slot; // of key in found, if it's frozen, else -1
+	int present; // whether key is in list after the ops
+	void* data;
+	int intrusive; // found is intrusive, and the ops keep it (see coalesce_op)
+	node_t* new_node; // preallocated, if the group may insert
+	frozen_node_t* spare; // for split_frozen, if needed
+	node_t* removed;
+} txn_group_t;
+
+/* Ops are evaluated on copies (work), sorted by key, so nothing the caller
+ * passed changes unless the transaction commits. kept - locks of group
+ * positions, held until the transaction ends. */
+typedef struct txn_t {
+	op_t* work;
+	op_t** sorted;
+	int* computed; // results of COMPUTE ops
+	txn_group_t* groups;
+	int num_groups;
+	mutex_t** kept;
+	int num_kept;
+} txn_t;
+
+static void txn_free(txn_t* txn) {
+	for (int g = 0; txn->groups && g < txn->num_groups; g++) {
+		free(txn->groups[g].new_node); // not linked
+		free(txn->groups[g].spare);
+	}
+	free(txn->kept);
+	free(txn->groups);
+	free(txn->computed);
+	free(txn->sorted);
+	free(txn->work);
+}
+
+//@Return: SUCCESS or MEM_ERROR (then txn is freed)
+static int txn_prepare(txn_t* txn, op_t* ops, int num_ops) {
+	memset(txn, 0, sizeof(*txn));
+	MALLOC_N_ORELSE(txn->work, num_ops, goto mem_error);
+	MALLOC_N_ORELSE(txn->sorted, num_ops, goto mem_error);
+	MALLOC_N_ORELSE(txn->computed, num_ops, goto mem_error);
+	for (int i = 0; i < num_ops; i++) {
+		txn->work[i] = ops[i];
+		if (ops[i].op == COMPUTE && ops[i].data)
+			txn->work[i].data = &txn->computed[i];
+		txn->sorted[i] = &txn->work[i];
+	}
+	qsort(txn->sorted, num_ops, sizeof(*txn->sorted), compare_ops_by_key);
+
+	txn->num_groups = 1;
+	for (int i = 1; i < num_ops; i++)
+		txn->num_groups += txn->sorted[i]->key != txn->sorted[i - 1]->key;
+	txn->groups = calloc(txn->num_groups, sizeof(*txn->groups));
+	MALLOC_N_ORELSE(txn->kept, 2 * txn->num_groups, goto mem_error);
+	if (!txn->groups)
+		goto mem_error;
+	for (int first = 0, i = 1, g = 0; i <= num_ops; i++) {
+		if (i < num_ops && txn->sorted[i]->key == txn->sorted[first]->key)
+			continue;
+		txn->groups[g].ops = &txn->sorted[first];
+		txn->groups[g].num_ops = i - first;
+		if (group_may_insert(&txn->sorted[first], i - first)
+				&& !(txn->groups[g].new_node = alloc_node()))
+			goto mem_error;
+		g++;
+		first = i;
+	}
+	return SUCCESS;
+
+mem_error:
+	txn_free(txn);
+	return MEM_ERROR;
+}
+
+/* Positions every group in a single sweep from the head, in ascending key
+ * order like any walk (so it can't deadlock with them), keeping the locks of
+ * each position (the node below key, and the one after it) in txn->kept,
+ * and evaluates the group there.
+ * Required locks: cleanup_lock (as reader), mode_lock (see enter_point_op).
+ */
+static void txn_lock_groups(linked_list_t* list, txn_t* txn, int coarse) {
+	mutex_t *prev_lock = NULL, *next_lock = NULL;
+	int prev_kept = 0, next_kept = 0;
+	node_t* prev = NULL;
+	if (!coarse)
+		lock_head(list, &prev_lock, &next_lock);
+	for (int g = 0; g < txn->num_groups; g++) {
+		txn_group_t* group = &txn->groups[g];
+		int key = group->ops[0]->key;
+		node_t* current = prev ? prev->next : list->head; // locked, if exists
+		while (current && current->key < key) {
+			if (!prev_kept)
+				mutex_unlock_safe(prev_lock);
+			prev_kept = next_kept;
+			next_kept = 0;
+			prev = current;
+			prev_lock = next_lock;
+			current = current->next;
+			if (current && !coarse) {
+				lock_traced(&current->lock);
+				PREFETCH(current->next);
+			}
+			next_lock = current && !coarse ? &current->lock : NULL;
+		}
+		if (!prev_kept && prev_lock)
+			txn->kept[txn->num_kept++] = prev_lock;
+		if (!next_kept && next_lock)
+			txn->kept[txn->num_kept++] = next_lock;
+		prev_kept = next_kept = 1;
+
+		group->prev = prev;
+		group->frozen = frozen_at(prev, current, key);
+		group->slot = group->frozen ? frozen_find(group->frozen, key) : -1;
+		if (group->frozen)
+			group->found = group->slot >= 0 ? &group->frozen->node : NULL;
+		else
+			group->found = current && current->key == key ? current : NULL;
+		group->present = group->found != NULL;
+		group->data = group->found ? *data_of(group->found, group->slot) : NULL;
+		group->intrusive = group->found && __atomic_load_n(&group->found->flags,
+				__ATOMIC_RELAXED) & NODE_INTRUSIVE;
+		int can_insert = group->new_node != NULL;
+		if (can_insert && group->frozen && !group->found
+				&& split_needs_view(group->frozen, key))
+			can_insert = (group->spare = alloc_frozen()) != NULL;
+		for (int i = 0; i < group->num_ops; i++)
+			coalesce_op(group->ops[i], &group->present, &group->data,
+					&group->intrusive, can_insert);
+	}
+	if (!prev_kept)
+		mutex_unlock_safe(prev_lock);
+	if (!next_kept)
+		mutex_unlock_safe(next_lock);
+}
+
+/* Applies the net effect of every group. Groups go from the last key down,
+ * so positions of the remaining groups (all below) are still valid: a group
+ * only relinks the node at its position.
+ * Required locks: all of txn->kept.
+ * @Return: change in list size.
+ */
+static int txn_apply(linked_list_t* list, txn_t* txn) {
+	int size_diff = 0;
+	for (int g = txn->num_groups - 1; g >= 0; g--) {
+		txn_group_t* group = &txn->groups[g];
+		if (group->found && group->present && !group->intrusive
+				&& __atomic_load_n(&group->found->flags, __ATOMIC_RELAXED)
+						& NODE_INTRUSIVE) {
+			// intrusive node removed and inserted again: the hook goes
+			key_changing(list, LIST_EVENT_REMOVE, group->found->key,
+					group->found->data);
+			group->removed = group->prev ? remove_after(list, group->prev)
+					: remove_first(list);
+			group->found = NULL;
+			size_diff--;
+		}
+		if (group->found && !group->present) {
+			if (group->frozen)
+				group->removed = frozen_remove(list, group->prev, group->frozen,
+						group->slot);
+			else {
+				key_changing(list, LIST_EVENT_REMOVE, group->found->key,
+						group->found->data);
+				group->removed = group->prev ? remove_after(list, group->prev)
+						: remove_first(list);
+			}
+			size_diff--;
+		} else if (!group->found && group->present) {
+			if (group->frozen) { // a lower group may still use frozen
+				int thaw_below = !g || txn->groups[g - 1].frozen != group->frozen;
+				group->removed = split_frozen(list, group->prev, group->frozen,
+						group->ops[0]->key, group->spare, thaw_below);
+				group->spare = NULL;
+			}
+			key_changing(list, LIST_EVENT_INSERT, group->ops[0]->key, group->data);
+			init_node(group->new_node, group->ops[0]->key, group->data);
+			if (group->prev)
+				insert_after(list, group->prev, group->new_node);
+			else
+				insert_first(list, group->new_node);
+			group->new_node = NULL;
+			size_diff++;
+		} else if (group->found
+				&& *data_of(group->found, group->slot) != group->data) {
+			wait_for_readers(group->found);
+			key_changing(list, LIST_EVENT_UPDATE, group->ops[0]->key, group->data);
+			*data_of(group->found, group->slot) = group->data;
+		}
+	}
+	return size_diff;
+}
+
+//@Return: 1 if op's result aborts the transaction
+static int txn_op_failed(const op_t* op) {
+	if (op->op == CONTAINS)
+		return 0; // result is whether key is present
+	if (op->op == GET_OR_INSERT && op->result == ALREADY_IN_LIST)
+		return 0;
+	return op->result != SUCCESS;
+}
+
+/*------------------------------- Online split -------------------------------*/
+
+/* Nodes moved from list to shards per step. List head is locked for a step,
+ * so ops on list wait for migration at most that long. */
+#define MIGRATE_STEP 64
+
+/* Shard being filled by migration, and its last node (NULL - shard is
+ * empty, then tail_lock is shard head lock). Moved keys are above any key
+ * in shard, so they're appended after tail. Tail is locked only during a
+ * step: between steps, ops redirected to shard may append keys (below
+ * moved_below) after it, so each step goes on from tail to the end of
+ * shard. Meanwhile, tail is kept as a reader of its node, so it's neither
+ * freed nor unlinked. The shard is kept in fine mode (by holding its
+ * mode_lock shared) while it's being filled.
+ * Locks of list are taken while holding locks of shard and vice versa, but
+ * only by the migrating thread, so it can't deadlock. */
+typedef struct migration_t {
+	linked_list_t* list;
+	linked_list_t* shard;
+	node_t* tail;
+	mutex_t* tail_lock;
+} migration_t;
+
+static void finish_shard(migration_t* migration) {
+	if (!migration->shard)
+		return;
+	pthread_mutex_unlock(migration->tail_lock);
+	exit_bulk_op(migration->shard);
+	migration->shard = NULL;
+}
+
+//positions migration at the end of shard, which key will be appended to
+static void start_shard(migration_t* migration, linked_list_t* shard,
+		int key) {
+	mutex_t* next_lock;
+	finish_shard(migration);
+	migration->shard = shard;
+	enter_bulk_op(shard);
+	migration->tail = closest_below_key(shard, key, 0, &migration->tail_lock,
+			&next_lock);
+	assert(!next_lock); // keys in shard are below moved_below <= key
+}
+
+//releases tail between steps, see migration_t
+static void pause_shard(migration_t* migration) {
+	assert(migration->tail); // a step appends to its shard
+	__atomic_add_fetch(&migration->tail->flags, NODE_READER, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(migration->tail_lock);
+}
+
+/* Locks the end of shard again. If a writer holds tail (waiting for this
+ * reader to leave), lets it go on, and finds the end from the head of shard
+ * instead (keys in shard are below any key in list, so below INT_MAX). */
+static void resume_shard(migration_t* migration) {
+	node_t* tail = migration->tail;
+	int locked = !pthread_mutex_trylock(&tail->lock);
+	__atomic_sub_fetch(&tail->flags, NODE_READER, __ATOMIC_RELEASE);
+	if (!locked) {
+		linked_list_t* shard = migration->shard;
+		exit_bulk_op(shard);
+		migration->shard = NULL;
+		start_shard(migration, shard, INT_MAX);
+		return;
+	}
+	while (tail->next) {
+		pthread_mutex_lock(&tail->next->lock);
+		pthread_mutex_unlock(&tail->lock);
+		tail = tail->next;
+	}
+	migration->tail = tail;
+	migration->tail_lock = &tail->lock;
+}
+
+/* Moves up to MIGRATE_STEP nodes from the head of list to the ends of
+ * their shards, then advances moved_below past them.
+ * Required locks: cleanup_lock (as reader).
+ * @Return: 1 if list still has nodes to move
+ */
+static int migrate_step(migration_t* migration) {
+	linked_list_t* list = migration->list;
+	enter_bulk_op(list);
+	pthread_mutex_lock(&list->head_ptr_lock);
+	if (migration->shard)
+		resume_shard(migration);
+	for (int i = 0; i < MIGRATE_STEP && list->head; i++) {
+		node_t* node = list->head;
+		linked_list_t* shard = shard_of(list, node->key);
+		if (shard != migration->shard)
+			start_shard(migration, shard, node->key);
+		pthread_mutex_lock(&node->lock); // ops in front of it leave first
+		remove_first(list);
+		if (migration->tail)
+			insert_after(shard, migration->tail, node);
+		else
+			insert_first(shard, node);
+		pthread_mutex_unlock(migration->tail_lock);
+		migration->tail = node;
+		migration->tail_lock = &node->lock;
+
+		int keys = keys_in(node); // a frozen node moves whole
+		pthread_mutex_lock(&list->size_lock);
+		list->size -= keys;
+		pthread_mutex_unlock(&list->size_lock);
+		pthread_mutex_lock(&shard->size_lock);
+		shard->size += keys;
+		pthread_mutex_unlock(&shard->size_lock);
+	}
+	int more = list->head != NULL;
+	__atomic_store_n(&list->moved_below, more ? list->head->key : LLONG_MAX,
+			__ATOMIC_SEQ_CST);
+	cache_invalidate_all(list); // so lookups of moved keys miss, and forward
+	if (more && migration->shard)
+		pause_shard(migration);
+	pthread_mutex_unlock(&list->head_ptr_lock);
+	exit_bulk_op(list);
+	return more;
+}
+
+/*-------------------------------- Compaction --------------------------------*/
+
+/* Nodes visited per step of list_compact. All locks (and mode_lock) are
+ * released between steps, so ops in coarse mode aren't held off by a whole
+ * pass. */
+#define COMPACT_STEP 256
+
+/* Block being filled by list_compact (NULL - none yet), and where it was
+ * left between steps */
+typedef struct compaction_t {
+	node_block_t* block;
+	int next_slot;
+	node_t* last; // last node visited
+	uintptr_t last_before; // its address before the pass
+	node_t* last_in_block; // last node visited, which is in a block
+	list_compact_stats_t stats;
+} compaction_t;
+
+#define PAGE_OF(address) ((uintptr_t) (address) / NODE_BLOCK_SIZE)
+
+static inline int in_block(node_t* node) {
+	// flags change under computes, which don't hold the node lock
+	return __atomic_load_n(&node->flags, __ATOMIC_RELAXED) & NODE_IN_BLOCK;
+}
+
+//whether node comes after prev (a block node or NULL) in the same block
+static inline int follows_in_block(node_t* prev, node_t* node) {
+	return prev && node && in_block(node) && block_of(node) == block_of(prev)
+			&& node > prev;
+}
+
+/* Nodes not in a block are moved. A node in a block stays, if it's a part
+ * of a run there: after the last block node passed, or before the next node.
+ * Otherwise it's moved, if that makes a run in the block being filled: after
+ * the node placed last, or before the next node, if that one moves too.
+ * Blocks are filled in key order, so a pass over a list which didn't change
+ * since the last pass moves nothing.
+ * Required locks: node, node->next */
+static int should_move(compaction_t* compaction, node_t* node) {
+	node_t* last = compaction->last_in_block;
+	node_t* next = node->next;
+	if (!in_block(node))
+		return 1;
+	if (follows_in_block(last, node) || follows_in_block(node, next))
+		return 0;
+	if (last && block_of(last) == compaction->block)
+		return 1;
+	return next && (!in_block(next) || !follows_in_block(next, next->next));
+}
+
+//@Return: free slot of the block being filled (or of a new one), or NULL
+static node_t* next_slot(compaction_t* compaction) {
+	if (!compaction->block || compaction->next_slot == NODE_BLOCK_SLOTS) {
+		void* block;
+		if (posix_memalign(&block, NODE_BLOCK_SIZE, NODE_BLOCK_SIZE))
+			return NULL;
+		if (compaction->block)
+			release_block(compaction->block);
+		compaction->block = block;
+		compaction->block->refs = 1;
+		compaction->next_slot = 1; // after the header
+	}
+	return (node_t*) ((char*) compaction->block
+			+ compaction->next_slot * NODE_SLOT_SIZE);
+}
+
+/* Moves node (after prev, NULL - head) into slot, and retires it. Like
+ * removal, it relies on hand-over-hand locking: nobody else can reach node
+ * once it's unlinked.
+ * Required locks: prev (or head), node, node->next. Returns slot, which
+ * remains locked.
+ */
+static node_t* relocate(linked_list_t* list, compaction_t* compaction,
+		node_t* prev, node_t* node, node_t* slot) {
+	init_node(slot, node->key, node->data);
+	slot->flags = NODE_IN_BLOCK;
+	slot->next = node->next;
+	pthread_mutex_lock(&slot->lock);
+	__atomic_add_fetch(&compaction->block->refs, 1, __ATOMIC_RELAXED);
+	compaction->next_slot++;
+	if (list->index)
+		index_replace(list->index, node, slot);
+	if (prev)
+		prev->next = slot;
+	else
+		list->head = slot;
+	pthread_mutex_unlock(&node->lock);
+	retire_node(node);
+	return slot;
+}
+
+/* Compacts up to COMPACT_STEP nodes, from the 1st node with key >= *from,
+ * and advances *from to the next node to compact (beyond INT_MAX at the
+ * end of list).
+ * Required locks: cleanup_lock (as reader).
+ */
+static int compact_step(linked_list_t* list, compaction_t* compaction,
+		long long* from) {
+	mutex_t *prev_lock, *next_lock;
+	int res = SUCCESS;
+	enter_bulk_op(list);
+	node_t* prev = closest_below_key(list, (int) *from, 0, &prev_lock, &next_lock);
+	node_t* current = prev ? prev->next : list->head; // locked, if exists
+	uintptr_t prev_before = prev == compaction->last ? compaction->last_before
+			: (uintptr_t) prev;
+	for (int i = 0; current && i < COMPACT_STEP; i++) {
+		uintptr_t before = (uintptr_t) current;
+		if (current->next) // locked before it's needed, to look ahead
+			pthread_mutex_lock(&current->next->lock);
+		int flags = __atomic_load_n(&current->flags, __ATOMIC_ACQUIRE);
+		// readers only leave while current is locked, so they're never moved
+		if (!(flags & (NODE_INTRUSIVE | NODE_FROZEN)) && flags < NODE_READER
+				&& should_move(compaction, current)) {
+			node_t* slot = next_slot(compaction);
+			if (!slot) {
+				mutex_unlock_safe(current->next ? &current->next->lock : NULL);
+				res = MEM_ERROR;
+				break;
+			}
+			current = relocate(list, compaction, prev, current, slot);
+			next_lock = &current->lock;
+			compaction->stats.moved++;
+		}
+		compaction->stats.nodes++;
+		if (in_block(current))
+			compaction->last_in_block = current;
+		if (prev) {
+			compaction->stats.local_links_before +=
+					PAGE_OF(prev_before) == PAGE_OF(before);
+			compaction->stats.local_links_after +=
+					PAGE_OF(prev) == PAGE_OF(current);
+		}
+		pthread_mutex_unlock(prev_lock);
+		prev_lock = next_lock;
+		prev = current;
+		prev_before = before;
+		current = current->next;
+		next_lock = current ? &current->lock : NULL;
+	}
+	compaction->last = prev;
+	compaction->last_before = prev_before;
+	if (res == SUCCESS)
+		*from = current ? current->key : (long long) INT_MAX + 1;
+	mutex_unlock_safe(prev_lock);
+	mutex_unlock_safe(next_lock);
+	exit_bulk_op(list);
+	return res;
+}
+
+/*--------------------------------- Freezing ---------------------------------*/
+
+/* Nodes visited per step of list_freeze (see COMPACT_STEP). A run is
+ * frozen whole, even if it crosses the end of a step. */
+#define FREEZE_STEP 1024
+
+/* Scratch of list_freeze: a run of nodes, and the keys and data they hold */
+typedef struct freeze_run_t {
+	node_t* nodes[FROZEN_MAX_KEYS];
+	int keys[FROZEN_MAX_KEYS];
+	void* datas[FROZEN_MAX_KEYS];
+} freeze_run_t;
+
+/* Frozen nodes with keys join runs too, so views left by splits merge with
+ * the nodes around them (a run of a single view isn't frozen again).
+ * Required locks: node */
+static inline int can_freeze(node_t* node) {
+	int flags = __atomic_load_n(&node->flags, __ATOMIC_ACQUIRE);
+	// readers only leave while node is locked, so they're never frozen
+	return !(flags & NODE_INTRUSIVE) && flags < NODE_READER && keys_in(node);
+}
+
+/* Links frozen (locked) in place of the run of n nodes after prev (NULL -
+ * head), and retires them.
+ * Required locks: prev (or head), nodes of the run, the node after it */
+static void replace_run(linked_list_t* list, node_t* prev, node_t** run,
+		int n, frozen_node_t* frozen) {
+	frozen->node.next = run[n - 1]->next;
+	// counted before keys leave the index, see find_indexed
+	__atomic_add_fetch(&list->frozen_nodes, 1, __ATOMIC_SEQ_CST);
+	if (prev)
+		prev->next = &frozen->node;
+	else
+		list->head = &frozen->node;
+	for (int i = 0; i < n; i++) { // keys stay in the filter
+		if (as_frozen(run[i]))
+			__atomic_sub_fetch(&list->frozen_nodes, 1, __ATOMIC_SEQ_CST);
+		else if (list->index)
+			index_remove(list->index, run[i]);
+		pthread_mutex_unlock(&run[i]->lock);
+		retire_node(run[i]);
+	}
 }
 
-/* Return pointer to node v, where v.key < key. If for each node
- * node.key >= key (i.e. node with key should be 1st), returns NULL
- * (including the case when list is empty).
- * Returns pointers to locks it acquired, in output variables prev_lock and next_lock.
- *
- * Uses hand-over-hand locking. Upon calling no node has to be locked.
- *
- * Locks info (upon return):
- * if returns last node - last node locked
- * if returns NULL (only head is below key) - locks head and (if exists) the 1st node
- * otherwise locks closest below and next to it
+/* Replaces view (locked) after prev (NULL - head) by nodes of its keys,
+ * the last one locked, and retires it.
+ * Required locks: prev (or head), view
+ * @Return: the last node, or NULL if out of memory (view stays)
  */
-static node_t* closest_below_key(linked_list_t* list, int key,
-		mutex_t** prev_lock, mutex_t** next_lock) {
-	assert(list && prev_lock && next_lock);
-	*prev_lock = &list->head_ptr_lock;
-	*next_lock = NULL;
+static node_t* thaw_view(linked_list_t* list, node_t* prev,
+		frozen_node_t* view) {
+	node_t* next = view->node.next;
+	node_t* thawed = thaw_keys(view, view->begin, view->end, next);
+	if (!thawed)
+		return NULL;
+	node_t* last = thawed;
+	while (last->next != next)
+		last = last->next;
+	pthread_mutex_lock(&last->lock); // no one else can reach it yet
+	if (prev) // keys stay in the filter
+		prev->next = thawed;
+	else
+		list->head = thawed;
+	index_thawed(list, thawed, next);
+	__atomic_sub_fetch(&list->frozen_nodes, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&view->node.lock);
+	retire_node(&view->node);
+	return last;
+}
 
-	pthread_mutex_lock(&list->head_ptr_lock);
-	node_t *prev = NULL, *current = list->head;
-	if (list->head) {
-		pthread_mutex_lock(&list->head->lock);
-		*next_lock = &list->head->lock;
-	}
-	while (current && current->key < key) { //we enter here only if there's at least 1 node
-		pthread_mutex_unlock(*prev_lock);
+/* Freezes runs of at least min_run keys, which can be frozen, among nodes
+ * from the 1st one with key >= *from on, and advances *from, like
+ * compact_step. Views with less than FROZEN_THAW_KEYS keys, which are left
+ * out of runs, are thawed, and empty ones are unlinked.
+ * Required locks: cleanup_lock (as reader).
+ * @Return: number of keys frozen into new segments, or a negative error code.
+ */
+static int freeze_step(linked_list_t* list, int min_run, freeze_run_t* run,
+		long long* from) {
+	mutex_t *prev_lock, *next_lock;
+	int res = 0;
+	enter_bulk_op(list);
+	node_t* prev = closest_below_key(list, (int) *from, 0, &prev_lock, &next_lock);
+	node_t* current = prev ? prev->next : list->head; // locked, if exists
+	for (int visited = 0; current && visited < FREEZE_STEP;) {
+		int n = 0, keys = 0, views = 0;
+		node_t* after = current; // the node after the run, locked, if exists
+		while (after && can_freeze(after)
+				&& keys + keys_in(after) <= FROZEN_MAX_KEYS) {
+			frozen_node_t* view = as_frozen(after);
+			for (int i = view ? view->begin : 0; view && i < view->end; i++) {
+				if (frozen_removed(view->seg, i))
+					continue;
+				run->keys[keys] = frozen_key(view->seg, i);
+				run->datas[keys++] = view->seg->datas[i];
+			}
+			if (!view) {
+				run->keys[keys] = after->key;
+				run->datas[keys++] = after->data;
+			}
+			views += view != NULL;
+			run->nodes[n++] = after;
+			if ((after = after->next))
+				pthread_mutex_lock(&after->lock);
+		}
+		visited += n ? n : 1;
+		if (n && (keys < min_run || (n == 1 && views))) {
+			for (int i = 0; i < n; i++) { // run->nodes[n - 1] becomes prev
+				frozen_node_t* view = as_frozen(run->nodes[i]);
+				node_t* last = view && view->live < FROZEN_THAW_KEYS
+						? thaw_view(list, i ? run->nodes[i - 1] : prev, view)
+						: NULL;
+				if (last)
+					run->nodes[i] = last;
+				if (i < n - 1)
+					pthread_mutex_unlock(&run->nodes[i]->lock);
+			}
+			current = run->nodes[n - 1];
+		} else if (n) {
+			frozen_node_t* frozen = freeze_keys(run->keys, run->datas, keys);
+			if (!frozen) {
+				for (int i = 1; i < n; i++)
+					pthread_mutex_unlock(&run->nodes[i]->lock);
+				mutex_unlock_safe(after ? &after->lock : NULL);
+				res = -MEM_ERROR;
+				break;
+			}
+			pthread_mutex_lock(&frozen->node.lock);
+			replace_run(list, prev, run->nodes, n, frozen);
+			res += keys;
+			current = &frozen->node;
+		} else if (!keys_in(current)) { // empty frozen node
+			if ((after = current->next))
+				pthread_mutex_lock(&after->lock);
+			if (prev)
+				remove_after(list, prev);
+			else
+				remove_first(list);
+			pthread_mutex_unlock(&current->lock);
+			retire_node(current);
+			current = after;
+			next_lock = after ? &after->lock : NULL;
+			continue;
+		} else if ((after = current->next)) {
+			pthread_mutex_lock(&after->lock);
+		}
+		pthread_mutex_unlock(prev_lock);
 		prev = current;
-		*prev_lock = *next_lock;
-		current = current->next;
-		if (current)
-			pthread_mutex_lock(&current->lock); //updated current, i.e. next node
-		*next_lock = current ? &current->lock : NULL;
+		prev_lock = &current->lock;
+		current = after;
+		next_lock = after ? &after->lock : NULL;
 	}
-	return prev;
+	if (res >= 0)
+		*from = current ? current->key : (long long) INT_MAX + 1;
+	mutex_unlock_safe(prev_lock);
+	mutex_unlock_safe(next_lock);
+	exit_bulk_op(list);
+	return res;
 }
 
-/* Returns with lock on found node only, or without any lock,
- * if node with key not found.
- * Required locks - none.
- */
-static node_t* find(linked_list_t* list, int key) {
-	assert(list);
-	node_t* found = NULL;
-	mutex_t *prev_lock, *next_lock;
+/*--------------------------------- Teardown ---------------------------------*/
+
+/* Nodes of a large list are destroyed by workers: the freeing thread walks
+ * the chain (missing the cache on about every node), cuts it into chunks,
+ * and queues them, so destroying nodes overlaps the walk. Smaller lists (or
+ * a single CPU) are torn down by the freeing thread alone. */
+#define TEARDOWN_CHUNK 4096 // nodes
+#define TEARDOWN_MIN_NODES (TEARDOWN_CHUNK * 4)
+#define TEARDOWN_MAX_WORKERS 8
+#define TEARDOWN_QUEUE 64
 
-	node_t* prev = closest_below_key(list, key, &prev_lock, &next_lock);
-	if (prev && prev->next && prev->next->key == key) { //both locked now
-		found = prev->next;
-	} else if (!prev && list->head && list->head->key == key) {
-		// prev == NULL, but there's at least 1 node in list, and then 1st node is locked too
-		found = list->head;
+typedef struct teardown_t {
+	pthread_mutex_t lock;
+	pthread_cond_t changed; // chunk queued or taken, or walk ended
+	node_t* chunks[TEARDOWN_QUEUE];
+	int first, count;
+	int walked;
+} teardown_t;
+
+static void* destroy_chunks(void* arg) {
+	teardown_t* teardown = (teardown_t*) arg;
+	pthread_mutex_lock(&teardown->lock);
+	for (;;) {
+		while (!teardown->count && !teardown->walked)
+			pthread_cond_wait(&teardown->changed, &teardown->lock);
+		if (!teardown->count)
+			break;
+		node_t* chunk = teardown->chunks[teardown->first];
+		teardown->first = (teardown->first + 1) % TEARDOWN_QUEUE;
+		teardown->count--;
+		pthread_cond_broadcast(&teardown->changed);
+		pthread_mutex_unlock(&teardown->lock);
+		destroy_chain(chunk);
+		pthread_mutex_lock(&teardown->lock);
 	}
-	mutex_unlock_safe(prev_lock);
-	if (!found)
-		mutex_unlock_safe(next_lock);
-	return found;
+	pthread_mutex_unlock(&teardown->lock);
+	return NULL;
 }
 
-static inline void list_init(linked_list_t* list) {
-	assert(list);
-	list->head = NULL;
-	list->size = 0;
-	pthread_mutex_init(&list->size_lock, NULL);
-	pthread_mutex_init(&list->head_ptr_lock, NULL);
-	rc_lock_init(&list->cleanup_lock);
+static void queue_chunk(teardown_t* teardown, node_t* chunk) {
+	pthread_mutex_lock(&teardown->lock);
+	while (teardown->count == TEARDOWN_QUEUE)
+		pthread_cond_wait(&teardown->changed, &teardown->lock);
+	teardown->chunks[(teardown->first + teardown->count) % TEARDOWN_QUEUE] =
+			chunk;
+	teardown->count++;
+	pthread_cond_broadcast(&teardown->changed);
+	pthread_mutex_unlock(&teardown->lock);
 }
 
-//required locks: cleanup_lock
-static void list_cleanup(linked_list_t* list) {
-	assert(list);
-	node_t *current = list->head, *next = NULL;
-	while (current) {
-		next = current->next;
-		free(current);
-		current = next;
+/* Destroys a chain of about size keys (see destroy_chain), on workers if
+ * it's large. Doesn't allocate, but for the workers' threads. */
+static void teardown_chain(node_t* chain, int size) {
+	int num_workers = sysconf(_SC_NPROCESSORS_ONLN) - 1; // and the walk
+	if (num_workers > size / TEARDOWN_CHUNK)
+		num_workers = size / TEARDOWN_CHUNK;
+	if (num_workers > TEARDOWN_MAX_WORKERS)
+		num_workers = TEARDOWN_MAX_WORKERS;
+	if (size < TEARDOWN_MIN_NODES || num_workers < 1) {
+		destroy_chain(chain);
+		return;
 	}
-	pthread_mutex_destroy(&list->size_lock);
-	pthread_mutex_destroy(&list->head_ptr_lock);
-}
 
-static inline int alloc_and_init_list_array(int n, linked_list_t** arr) {
-	int i = 0;
-	for (; i < n; i++) {
-		arr[i] = list_alloc();
-		if (arr[i] == NULL)
-			goto cleanup;
-		list_init(arr[i]);
+	teardown_t teardown = { .first = 0, .count = 0, .walked = 0 };
+	pthread_t workers[TEARDOWN_MAX_WORKERS];
+	int spawned = 0;
+	pthread_mutex_init(&teardown.lock, NULL);
+	pthread_cond_init(&teardown.changed, NULL);
+	while (spawned < num_workers
+			&& !pthread_create(&workers[spawned], NULL, destroy_chunks, &teardown))
+		spawned++;
+	if (!spawned) {
+		destroy_chain(chain);
+	} else {
+		node_t *chunk = chain, *current = chain;
+		for (int count = 1; current; count++) {
+			node_t* next = current->next;
+			if (count == TEARDOWN_CHUNK || !next) {
+				current->next = NULL;
+				queue_chunk(&teardown, chunk);
+				chunk = next;
+				count = 0;
+			}
+			current = next;
+		}
+		pthread_mutex_lock(&teardown.lock);
+		teardown.walked = 1;
+		pthread_cond_broadcast(&teardown.changed);
+		pthread_mutex_unlock(&teardown.lock);
+		for (int i = 0; i < spawned; i++)
+			pthread_join(workers[i], NULL);
 	}
-	return SUCCESS;
+	pthread_cond_destroy(&teardown.changed);
+	pthread_mutex_destroy(&teardown.lock);
+}
 
-cleanup:
-	for (int j = 0; j < i; j++)
-		list_free(arr[j]);
-	return MEM_ERROR;
+/* Frees everything of list but its nodes.
+ * Required locks: cleanup_lock (taken by the freeing thread)
+ * @Return: chain of the nodes, to be torn down
+ */
+static node_t* release_list(linked_list_t* list, int* size) {
+	node_t* chain = list->head;
+	*size = list->size;
+	list->head = NULL;
+	list_cleanup(list);
+	rc_lock_destroy(&list->cleanup_lock);
+	free(list);
+	return chain;
+}
+
+/* Teardown of list_free_async. The chain may hold intrusive hooks, which
+ * the caller keeps valid until done is called (see my_list.h). */
+typedef struct async_teardown_t {
+	node_t* chain;
+	int size;
+	void (*done)(void* ctx);
+	void* ctx;
+} async_teardown_t;
+
+static void* teardown_async(void* arg) {
+	async_teardown_t* job = (async_teardown_t*) arg;
+	teardown_chain(job->chain, job->size);
+	if (job->done)
+		job->done(job->ctx);
+	free(job);
+	return NULL;
 }
 
 /*----------------------------Threaded functions wrapper----------------------*/
 
+/* Called with no locks held, so on_result may use the list */
+static void deliver_results(list_params_t* params) {
+	if (!params->on_result)
+		return;
+	for (int i = 0; i < params->num_ops; i++)
+		params->on_result(params->ops[i] - params->base, params->ops[i],
+				params->ctx);
+}
+
 static void* run_op(void* list_and_params) {
 	assert(list_and_params);
 
 	list_params_t* params = (list_params_t*) list_and_params;
-	assert(params->list && params->op_param);
-
-	op_t* op = params->op_param;
+	assert(params->list && params->ops);
 	linked_list_t* list = params->list;
 
-	switch (op->op) {
-	case INSERT:
-		op->result = list_insert(list, op->key, op->data);
-		break;
-	case REMOVE:
-		op->result = list_remove(list, op->key);
-		break;
-	case CONTAINS:
-		op->result = list_find(list, op->key);
-		break;
-	case UPDATE:
-		op->result = list_update(list, op->key, op->data);
-		break;
-	case COMPUTE:
-		op->result = list_compute(list, op->key, op->compute_func, op->data);
-		break;
-	default:
-		assert(0);
+	if (params->cpu >= 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(params->cpu, &cpus);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	}
+	if (params->num_ops == 0 || !read_lock(&list->cleanup_lock)) {
+		for (int i = 0; i < params->num_ops; i++)
+			params->ops[i]->result = CLEANUP_PENDING;
+		wait_for_head_turn(params->start, params->worker);
+		pass_head_turn(params->start, params->worker);
+		deliver_results(params);
+		return NULL;
+	}
+	int size_diff = sweep_key_range(list, params->ops, params->num_ops,
+			params->start, params->worker);
+	if (size_diff) {
+		pthread_mutex_lock(&list->size_lock);
+		list->size += size_diff;
+		pthread_mutex_unlock(&list->size_lock);
 	}
+	read_unlock(&list->cleanup_lock);
+	deliver_results(params);
 	return NULL; //since we have to return something
 }
 
 /**---------------------------- Interface functions --------------------------*/
 
 linked_list_t* list_alloc() {
+	return list_alloc_config(NULL);
+}
+
+linked_list_t* list_alloc_config(const list_config_t* config) {
 	linked_list_t* new_list;
 	MALLOC_ORELSE(new_list, return NULL);
 
 	list_init(new_list);
+	if (config)
+		new_list->config = *config;
+	else
+		memset(&new_list->config, 0, sizeof(new_list->config));
+
+	if (new_list->config.bloom_expected_keys) {
+		new_list->bloom = bloom_alloc(new_list->config.bloom_expected_keys,
+				new_list->config.bloom_fp_rate);
+		if (!new_list->bloom) {
+			list_free(new_list);
+			return NULL;
+		}
+	}
+	if (new_list->config.hash_index_buckets) {
+		new_list->index = index_alloc(new_list->config.hash_index_buckets);
+		if (!new_list->index) {
+			list_free(new_list);
+			return NULL;
+		}
+	}
+	if (new_list->config.read_cache) {
+		new_list->cache = cache_alloc();
+		if (!new_list->cache) {
+			list_free(new_list);
+			return NULL;
+		}
+	}
 	return new_list;
 }
 
 void list_free(linked_list_t* list) {
 	if (!list)
 		return;
-	if (!cleanup_lock(&list->cleanup_lock))
+	uint64_t wait_start = trace_cleanup_wait(TRACE_FREE);
+	int locked = cleanup_lock(&list->cleanup_lock);
+	trace_cleanup(TRACE_CLEANUP_LOCKED, TRACE_FREE, wait_start, locked);
+	if (!locked)
 		return;
 
-	list_cleanup(list);
-	rc_lock_destroy(&list->cleanup_lock);
-	free(list);
+	int size;
+	node_t* chain = release_list(list, &size);
+	teardown_chain(chain, size);
+	trace_cleanup(TRACE_CLEANUP_DONE, TRACE_FREE, 0, 1);
+}
+
+int list_free_async(linked_list_t* list, void (*done)(void* ctx), void* ctx) {
+	if (!list)
+		return NULL_ARG;
+	async_teardown_t* job;
+	MALLOC_ORELSE(job, return MEM_ERROR);
+	uint64_t wait_start = trace_cleanup_wait(TRACE_FREE);
+	int locked = cleanup_lock(&list->cleanup_lock);
+	trace_cleanup(TRACE_CLEANUP_LOCKED, TRACE_FREE, wait_start, locked);
+	if (!locked) {
+		free(job);
+		return CLEANUP_PENDING;
+	}
+
+	job->chain = release_list(list, &job->size);
+	job->done = done;
+	job->ctx = ctx;
+	pthread_attr_t attr;
+	pthread_t thread;
+	int spawned = !pthread_attr_init(&attr);
+	if (spawned) {
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		spawned = !pthread_create(&thread, &attr, teardown_async, job);
+		pthread_attr_destroy(&attr);
+	}
+	if (!spawned) // torn down right here, then
+		teardown_async(job);
+	trace_cleanup(TRACE_CLEANUP_DONE, TRACE_FREE, 0, 1);
+	return SUCCESS;
 }
 
 int list_split(linked_list_t* list, int n, linked_list_t** arr) {
@@ -343,189 +3727,1429 @@ int list_split(linked_list_t* list, int n, linked_list_t** arr) {
 		return NULL_ARG;
 	if (n <= 0)
 		return INVALID_ARG;
+	if (is_resharding(list))
+		return CLEANUP_PENDING;
 
-	if(alloc_and_init_list_array(n, arr) != SUCCESS)
+	if(alloc_and_init_list_array(list, n, arr) != SUCCESS)
 		return MEM_ERROR;
 	// TODO: for the assignment, we need to acquire lock as soon as possible,
 	// but, if new lists allocation fails, what do we do with lock?
 
-	if (!cleanup_lock(&list->cleanup_lock))
+	uint64_t wait_start = trace_cleanup_wait(TRACE_SPLIT);
+	int locked = cleanup_lock(&list->cleanup_lock);
+	trace_cleanup(TRACE_CLEANUP_LOCKED, TRACE_SPLIT, wait_start, locked);
+	if (!locked)
 		return CLEANUP_PENDING;
 
-	//Now no one can access the list, so we bypass nodes locks
+	/* Now no one can access the list, so we bypass nodes locks.
+	 * Nodes are moved (not copied), so intrusive nodes stay linked: each new
+	 * list gets its nodes in descending order, then is reversed. */
 	node_t* current = list->head;
 	int i = 0;
 	while (current) {
-		list_insert(arr[i], current->key, current->data);
+		node_t* next = current->next;
+		insert_first(arr[i], current);
+		arr[i]->size += keys_in(current);
 		i = (i + 1) % n;
-		current = current->next;
+		current = next;
+	}
+	list->head = NULL;
+	for (i = 0; i < n; i++) {
+		node_t *reversed = NULL;
+		current = arr[i]->head;
+		while (current) {
+			node_t* next = current->next;
+			current->next = reversed;
+			reversed = current;
+			current = next;
+		}
+		arr[i]->head = reversed;
 	}
 	list_cleanup(list);
 	rc_lock_destroy(&list->cleanup_lock);
 	free(list);
+	trace_cleanup(TRACE_CLEANUP_DONE, TRACE_SPLIT, 0, 1);
 	return SUCCESS;
 }
 
-int list_insert(linked_list_t* list, int key, void* data) {
-	if (!list)
+int list_split_online(linked_list_t* list, int n, linked_list_t** arr) {
+	if (!list || !arr)
 		return NULL_ARG;
+	if (n <= 0)
+		return INVALID_ARG;
 	if (!read_lock(&list->cleanup_lock))
 		return CLEANUP_PENDING;
-	//Now no one can access the list, so we bypass nodes locks
+	int not_resharding = 0;
+	if (!__atomic_compare_exchange_n(&list->resharding, &not_resharding,
+			RESHARD_CLAIMED, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+		read_unlock(&list->cleanup_lock);
+		return CLEANUP_PENDING;
+	}
+
+	list->shards = malloc(n * sizeof(*list->shards));
+	list->shard_bounds = malloc(n * sizeof(*list->shard_bounds));
+	if (!list->shards || !list->shard_bounds
+			|| alloc_and_init_list_array(list, n, arr) != SUCCESS) {
+		free(list->shards);
+		free(list->shard_bounds);
+		list->shards = NULL;
+		list->shard_bounds = NULL;
+		__atomic_store_n(&list->resharding, 0, __ATOMIC_SEQ_CST);
+		read_unlock(&list->cleanup_lock);
+		return MEM_ERROR;
+	}
+	memcpy(list->shards, arr, n * sizeof(*arr));
+	// ops on the whole list end first (so bounds don't fall into frozen
+	// ranges, either); new ones see resharding (see enter_whole_op)
+	while (__atomic_load_n(&list->whole_ops, __ATOMIC_SEQ_CST))
+		sched_yield();
+	// if list has less than n nodes, the last lists get no keys
+	enter_bulk_op(list);
+	list->num_bounds = sample_boundaries(list, n, list->shard_bounds, NULL,
+			NULL) - 1;
+	exit_bulk_op(list);
+	__atomic_store_n(&list->resharding, RESHARD_ACTIVE, __ATOMIC_SEQ_CST);
+
+	migration_t migration = { list, NULL, NULL, NULL };
+	while (migrate_step(&migration))
+		;
+	finish_shard(&migration);
+	read_unlock(&list->cleanup_lock);
+	return SUCCESS;
+}
+
+int list_for_each(linked_list_t* list, int num_threads,
+		void (*func)(int key, void* data, void* ctx), void* ctx) {
+	if (!list || !func)
+		return NULL_ARG;
+	if (num_threads <= 0)
+		return INVALID_ARG;
+	trace_op_start(TRACE_FOR_EACH, num_threads);
+	if (!read_lock_whole(list))
+		return trace_op_end(TRACE_FOR_EACH, num_threads, CLEANUP_PENDING);
+
+	segment_t template = { .visit = visit_for_each, .func = func, .ctx = ctx };
+	segment_t* segments;
+	int num_segments;
+	int res = visit_in_parallel(list, num_threads, &template, &segments,
+			&num_segments);
+	if (res == SUCCESS)
+		free(segments);
+	read_unlock_whole(list);
+	return trace_op_end(TRACE_FOR_EACH, num_threads, res);
+}
+
+int list_reduce(linked_list_t* list, int num_threads,
+		int (*reduce_func)(int acc, int key, void* data, void* ctx),
+		int (*combine_func)(int acc1, int acc2), void* ctx, int init,
+		int* result) {
+	if (!list || !reduce_func || !combine_func || !result)
+		return NULL_ARG;
+	if (num_threads <= 0)
+		return INVALID_ARG;
+	trace_op_start(TRACE_REDUCE, num_threads);
+	if (!read_lock_whole(list))
+		return trace_op_end(TRACE_REDUCE, num_threads, CLEANUP_PENDING);
+
+	segment_t template = { .visit = visit_reduce, .reduce_func = reduce_func,
+			.ctx = ctx, .acc = init };
+	segment_t* segments;
+	int num_segments;
+	int res = visit_in_parallel(list, num_threads, &template, &segments,
+			&num_segments);
+	if (res == SUCCESS) {
+		*result = segments[0].acc;
+		for (int i = 1; i < num_segments; i++)
+			*result = combine_func(*result, segments[i].acc);
+		free(segments);
+	}
+	read_unlock_whole(list);
+	return trace_op_end(TRACE_REDUCE, num_threads, res);
+}
+
+int list_remove_if(linked_list_t* list,
+		int (*pred)(int key, void* data, void* ctx), void* ctx,
+		void (*free_data)(void* data)) {
+	if (!list || !pred)
+		return -NULL_ARG;
+	trace_op_start(TRACE_REMOVE_IF, 0);
+	if (!read_lock_whole(list))
+		return trace_op_end(TRACE_REMOVE_IF, 0, -CLEANUP_PENDING);
+
+	node_t* removed = NULL;
+	data_array_t kept = { NULL, 0, 0, 0 };
+	int count = unlink_if(list, pred, ctx, &removed, free_data ? &kept : NULL);
+	publish_events(); // before free_data
+	if (count) {
+		pthread_mutex_lock(&list->size_lock);
+		list->size -= count;
+		pthread_mutex_unlock(&list->size_lock);
+	}
+	read_unlock_whole(list);
+
+	while (removed) {
+		node_t* next = removed->next;
+		void* data = removed->data;
+		int frozen = as_frozen(removed) != NULL; // its data is in kept
+		destroy_node(removed); // before free_data, which may free a hook's owner
+		if (free_data && !frozen)
+			free_data(data);
+		removed = next;
+	}
+	for (int i = 0; i < kept.count; i++)
+		free_data(kept.datas[i]);
+	free(kept.datas);
+	return trace_op_end(TRACE_REMOVE_IF, 0, kept.failed ? -MEM_ERROR : count);
+}
+
+int list_compact(linked_list_t* list, list_compact_stats_t* stats) {
+	if (!list)
+		return NULL_ARG;
+	trace_op_start(TRACE_COMPACT, 0);
+	if (!read_lock_whole(list))
+		return trace_op_end(TRACE_COMPACT, 0, CLEANUP_PENDING);
 
+	compaction_t compaction = { NULL, 0, NULL, 0, NULL, {0} };
+	long long from = INT_MIN;
 	int res = SUCCESS;
-	mutex_t *prev_lock, *next_lock;
-	node_t* new_node;
-	MALLOC_ORELSE(new_node, res=MEM_ERROR; goto unlock_rw);
-	init_node(new_node, key, data);
+	while (res == SUCCESS && from <= INT_MAX)
+		res = compact_step(list, &compaction, &from);
+	if (compaction.block)
+		release_block(compaction.block);
+	read_unlock_whole(list);
+	if (stats)
+		*stats = compaction.stats;
+	return trace_op_end(TRACE_COMPACT, 0, res);
+}
 
-	node_t* prev = closest_below_key(list, key, &prev_lock, &next_lock);
-	if ((prev && prev->next && prev->next->key == key)
-			|| (!prev && list->head && list->head->key == key)) {
-		destroy_node(new_node);
+int list_freeze(linked_list_t* list, int min_run) {
+	if (!list)
+		return -NULL_ARG;
+	if (min_run <= 0)
+		return -INVALID_ARG;
+	trace_op_start(TRACE_FREEZE, min_run);
+	if (!read_lock_whole(list))
+		return trace_op_end(TRACE_FREEZE, min_run, -CLEANUP_PENDING);
+	freeze_run_t* run;
+	int res = 0;
+	MALLOC_ORELSE(run, res = -MEM_ERROR);
+	long long from = INT_MIN;
+	while (res >= 0 && from <= INT_MAX) {
+		int frozen = freeze_step(list, min_run, run, &from);
+		res = frozen < 0 ? frozen : res + frozen;
+	}
+	free(run);
+	read_unlock_whole(list);
+	return trace_op_end(TRACE_FREEZE, min_run, res);
+}
+
+int list_subscribe(linked_list_t* list, int lo, int hi,
+		void (*func)(const list_event_t* event, void* ctx), void* ctx,
+		int queue_size, list_subscription_t** sub) {
+	if (!list || !sub)
+		return NULL_ARG;
+	if (lo > hi || (!func && (queue_size <= 0 || queue_size > (1 << 30))))
+		return INVALID_ARG;
+	unsigned long slots = 1;
+	while (!func && slots < (unsigned long) queue_size)
+		slots *= 2;
+	list_subscription_t* new_sub = malloc(sizeof(*new_sub)
+			+ (func ? 0 : slots * sizeof(event_slot_t)));
+	if (!new_sub)
+		return MEM_ERROR;
+	*new_sub = (list_subscription_t) { lo, hi, func, ctx, 0, 0, 0, slots - 1 };
+	for (unsigned long i = 0; !func && i < slots; i++)
+		new_sub->slots[i].seq = i;
+	if (!read_lock(&list->cleanup_lock)) {
+		free(new_sub);
+		return CLEANUP_PENDING;
+	}
+	int res = SUCCESS;
+	pthread_rwlock_wrlock(&list->subs_lock);
+	list_subscription_t** subs = realloc(list->subs,
+			(list->num_subs + 1) * sizeof(*subs));
+	if (subs) {
+		list->subs = subs;
+		subs[list->num_subs] = new_sub;
+		__atomic_store_n(&list->num_subs, list->num_subs + 1, __ATOMIC_RELAXED);
+	} else
+		res = MEM_ERROR;
+	pthread_rwlock_unlock(&list->subs_lock);
+	read_unlock(&list->cleanup_lock);
+	if (res == SUCCESS)
+		*sub = new_sub;
+	else
+		free(new_sub);
+	return res;
+}
+
+int list_poll_events(list_subscription_t* sub, list_event_t* events,
+		int max_events) {
+	if (!sub || !events)
+		return -NULL_ARG;
+	if (max_events < 0 || sub->func)
+		return -INVALID_ARG;
+	int count = 0;
+	while (count < max_events && dequeue_event(sub, &events[count]))
+		count++;
+	return count;
+}
+
+unsigned long list_events_lost(list_subscription_t* sub) {
+	return sub ? __atomic_load_n(&sub->lost, __ATOMIC_RELAXED) : 0;
+}
+
+int list_unsubscribe(linked_list_t* list, list_subscription_t* sub) {
+	if (!list || !sub)
+		return NULL_ARG;
+	if (!read_lock(&list->cleanup_lock))
+		return CLEANUP_PENDING;
+	int res = NOT_FOUND;
+	// waits for deliveries in progress, which hold it shared
+	pthread_rwlock_wrlock(&list->subs_lock);
+	for (int i = 0; i < list->num_subs; i++) {
+		if (list->subs[i] != sub)
+			continue;
+		list->subs[i] = list->subs[list->num_subs - 1];
+		__atomic_store_n(&list->num_subs, list->num_subs - 1, __ATOMIC_RELAXED);
+		res = SUCCESS;
+		break;
+	}
+	pthread_rwlock_unlock(&list->subs_lock);
+	read_unlock(&list->cleanup_lock);
+	if (res == SUCCESS)
+		free(sub);
+	return res;
+}
+
+/* Links initialized node into list, unless its key is already there.
+ * Required locks: cleanup_lock for reading */
+static int link_node(linked_list_t* list, node_t* new_node) {
+	int res = SUCCESS, key = new_node->key;
+	mutex_t *prev_lock, *next_lock;
+	node_t* unlinked = NULL;
+	frozen_node_t* spare = NULL;
+	int coarse = enter_point_op(list);
+	if (coarse < 0)
+		return lock_failure;
+	node_t* prev = closest_below_key(list, key, coarse, &prev_lock, &next_lock);
+	if (lock_failure) {
+		res = lock_failure;
+		goto unlock_prev_next;
+	}
+	if (moved_to(list, key)) {
+		res = MOVED;
+		goto unlock_prev_next;
+	}
+	node_t* next = prev ? prev->next : list->head;
+	frozen_node_t* frozen = frozen_at(prev, next, key);
+	if (frozen ? frozen_find(frozen, key) >= 0 : next && next->key == key) {
 		res = ALREADY_IN_LIST;
 		goto unlock_prev_next;
 	}
+	if (frozen) { // rare enough to allocate under the locks
+		if (split_needs_view(frozen, key) && !(spare = alloc_frozen())) {
+			res = MEM_ERROR;
+			goto unlock_prev_next;
+		}
+		if (!wait_for_readers(&frozen->node)) { // keys may move, see split_frozen
+			free(spare);
+			res = lock_failure;
+			goto unlock_prev_next;
+		}
+	}
+	if (!cache_invalidate(list, key)) {
+		free(spare);
+		res = lock_failure;
+		goto unlock_prev_next;
+	}
+	if (frozen)
+		unlinked = split_frozen(list, prev, frozen, key, spare, 1);
+	key_changing(list, LIST_EVENT_INSERT, key, new_node->data);
 	if (!prev)  // head_lock and (if exists) 1st node are locked
 		insert_first(list, new_node);
 	else		// prev and prev->next (if exists) are locked
-		insert_after(prev, new_node);
+		insert_after(list, prev, new_node);
 
 unlock_prev_next:
 	mutex_unlock_safe(prev_lock);
-	mutex_unlock_safe(next_lock);
+	mutex_unlock_safe(next_lock); // if unlinked - it's the unlinked node lock
+	exit_point_op(list);
+	publish_events();
+	if (unlinked)
+		retire_node(unlinked);
 	if (res == SUCCESS) {
 		pthread_mutex_lock(&list->size_lock);
 		list->size++;
 		pthread_mutex_unlock(&list->size_lock);
 	}
-
-unlock_rw:
-	read_unlock(&list->cleanup_lock);
+	return res;
+}
+
+int list_insert(linked_list_t* list, int key, void* data) {
+	if (!list)
+		return NULL_ARG;
+	trace_op_start(TRACE_INSERT, key);
+	if (!read_lock(&list->cleanup_lock))
+		return trace_op_end(TRACE_INSERT, key, CLEANUP_PENDING);
+
+	int res = SUCCESS;
+	node_t* new_node;
+	linked_list_t* shard = moved_to(list, key);
+	if (shard)
+		goto unlock_rw;
+	new_node = alloc_node();
+	if (!new_node) {
+		res = MEM_ERROR;
+		goto unlock_rw;
+	}
+	init_node(new_node, key, data);
+	res = link_node(list, new_node);
+	if (res != SUCCESS)
+		destroy_node(new_node);
+	if (res == MOVED)
+		shard = moved_to(list, key);
+
+unlock_rw:
+	read_unlock(&list->cleanup_lock);
+	if (shard)
+		res = list_insert(shard, key, data);
+	return trace_op_end(TRACE_INSERT, key, res);
+}
+
+int list_insert_node(linked_list_t* list, int key, list_hook_t* hook,
+		void* container) {
+	if (!list || !hook)
+		return NULL_ARG;
+	trace_op_start(TRACE_INSERT_NODE, key);
+	if (!read_lock(&list->cleanup_lock))
+		return trace_op_end(TRACE_INSERT_NODE, key, CLEANUP_PENDING);
+
+	int res = SUCCESS;
+	linked_list_t* shard = moved_to(list, key);
+	if (!shard) {
+		init_node(hook, key, container);
+		hook->flags |= NODE_INTRUSIVE;
+		res = link_node(list, hook);
+		if (res == MOVED)
+			shard = moved_to(list, key);
+	}
+	read_unlock(&list->cleanup_lock);
+	if (shard)
+		res = list_insert_node(shard, key, hook, container);
+	return trace_op_end(TRACE_INSERT_NODE, key, res);
+}
+
+/* Unlinks node with key, and returns it (unlocked) in *removed (NULL if
+ * key was frozen, and its frozen node stays). If intrusive_only, a node
+ * allocated by the list is left in it (INVALID_ARG).
+ * Required locks: cleanup_lock for reading */
+static int unlink_key(linked_list_t* list, int key, int intrusive_only,
+		node_t** removed) {
+	if (!may_contain(list, key))
+		return NOT_FOUND;
+
+	int res = SUCCESS;
+	mutex_t *prev_lock, *next_lock;
+	int coarse = enter_point_op(list);
+	if (coarse < 0)
+		return lock_failure;
+	node_t* prev = closest_below_key(list, key, coarse, &prev_lock, &next_lock);
+	if (lock_failure) {
+		res = lock_failure;
+		goto unlock_prev_next;
+	}
+	if (moved_to(list, key)) {
+		res = MOVED;
+		goto unlock_prev_next;
+	}
+	node_t* found = prev ? prev->next : list->head;
+	frozen_node_t* frozen = frozen_at(prev, found, key);
+	int slot = frozen ? frozen_find(frozen, key) : -1;
+	if (frozen)
+		found = slot >= 0 ? &frozen->node : NULL;
+	if (!found || found->key > key) {
+		res = NOT_FOUND;
+		goto unlock_prev_next;
+	}
+	if (intrusive_only
+			&& !(__atomic_load_n(&found->flags, __ATOMIC_RELAXED) & NODE_INTRUSIVE)) {
+		res = INVALID_ARG;
+		goto unlock_prev_next;
+	}
+	if (!wait_for_readers(found) || !cache_invalidate(list, key)) {
+		res = lock_failure;
+		goto unlock_prev_next;
+	}
+	if (frozen)
+		*removed = frozen_remove(list, prev, frozen, slot);
+	else {
+		key_changing(list, LIST_EVENT_REMOVE, key, found->data);
+		if (!prev)  // head_lock and 1st node are locked
+			*removed = remove_first(list);
+		else 	   // prev and prev->next are locked
+			*removed = remove_after(list, prev);
+	}
+
+unlock_prev_next:
+	mutex_unlock_safe(prev_lock);
+	mutex_unlock_safe(next_lock); // if removed - it's the removed node lock
+	exit_point_op(list);
+	publish_events();
+	if (res == SUCCESS) {
+		pthread_mutex_lock(&list->size_lock);
+		list->size--;
+		pthread_mutex_unlock(&list->size_lock);
+	}
 	return res;
 }
 
 int list_remove(linked_list_t* list, int key) {
 	if (!list)
 		return NULL_ARG;
+	trace_op_start(TRACE_REMOVE, key);
 	if (!read_lock(&list->cleanup_lock))
-		return CLEANUP_PENDING;
+		return trace_op_end(TRACE_REMOVE, key, CLEANUP_PENDING);
 
-	int res = SUCCESS;
-	mutex_t *prev_lock, *next_lock;
-	node_t* prev = closest_below_key(list, key, &prev_lock, &next_lock);
-	if ((prev && !prev->next) || (prev && prev->next && prev->next->key != key)
-			|| (!prev && !list->head)
-			|| (!prev && list->head && list->head->key != key)) {
-		res = NOT_FOUND;
-		goto unlock_prev_next;
-	}
-	if (!prev)  // head_lock and 1st node are locked
-		remove_first(list);
-	else 	   // prev and prev->next are locked
-		remove_after(prev);
+	node_t* removed;
+	linked_list_t* shard = moved_to(list, key);
+	int res = shard ? MOVED : unlink_key(list, key, 0, &removed);
+	if (res == SUCCESS && removed)
+		retire_node(removed);
+	if (res == MOVED)
+		shard = moved_to(list, key);
+	read_unlock(&list->cleanup_lock);
+	if (shard)
+		res = list_remove(shard, key);
+	return trace_op_end(TRACE_REMOVE, key, res);
+}
 
-unlock_prev_next:
-	mutex_unlock_safe(prev_lock);
-	if (res != SUCCESS) {
-		mutex_unlock_safe(next_lock); // if successfully deleted - this lock doesn't exist anymore
-	} else {
-		pthread_mutex_lock(&list->size_lock);
-		list->size--;
-		pthread_mutex_unlock(&list->size_lock);
-	}
+int list_remove_node(linked_list_t* list, int key, list_hook_t** hook) {
+	if (!list || !hook)
+		return NULL_ARG;
+	trace_op_start(TRACE_REMOVE_NODE, key);
+	if (!read_lock(&list->cleanup_lock))
+		return trace_op_end(TRACE_REMOVE_NODE, key, CLEANUP_PENDING);
+
+	linked_list_t* shard = moved_to(list, key);
+	int res = shard ? MOVED : unlink_key(list, key, 1, hook);
+	if (res == MOVED)
+		shard = moved_to(list, key);
 	read_unlock(&list->cleanup_lock);
-	return res;
+	if (shard)
+		res = list_remove_node(shard, key, hook);
+	return trace_op_end(TRACE_REMOVE_NODE, key, res);
 }
 
 int list_find(linked_list_t* list, int key) {
 	if (!list)
 		return NULL_ARG;
+	trace_op_start(TRACE_FIND, key);
 	if (!read_lock(&list->cleanup_lock))
-		return CLEANUP_PENDING;
+		return trace_op_end(TRACE_FIND, key, CLEANUP_PENDING);
 
-	node_t* found = find(list, key); //if found, node returns locked
-	if (found)
-		pthread_mutex_unlock(&found->lock);
+	node_t* found = NULL;
+	void* data = NULL;
+	int coarse;
+	unsigned long version = 0;
+	linked_list_t* shard = moved_to(list, key);
+	cache_entry_t* hit = !shard && list->cache ?
+			cache_lookup(list, key, 0, &version) : NULL;
+	if (hit) {
+		int present = hit->present;
+		read_unlock(&list->cleanup_lock);
+		return trace_op_end(TRACE_FIND, key, present);
+	}
+	if (!shard && may_contain(list, key)
+			&& (coarse = enter_point_op(list)) >= 0) {
+		mutex_t* found_lock;
+		int slot;
+		found = find_indexed(list, key, coarse, &found_lock, &slot); //if found, node returns locked
+		if (found)
+			data = *data_of(found, slot);
+		mutex_unlock_safe(found_lock);
+		exit_point_op(list);
+	}
+	if (!found && !lock_failure)
+		shard = moved_to(list, key); // maybe moved before find got to it
+	if (list->cache && !shard && !lock_failure)
+		cache_fill(list, key, version, found != NULL, data);
 
 	read_unlock(&list->cleanup_lock);
+	if (shard)
+		return trace_op_end(TRACE_FIND, key, list_find(shard, key));
 
-	return found != NULL;
+	return trace_op_end(TRACE_FIND, key,
+			lock_failure ? lock_failure : found != NULL);
 }
 
 int list_size(linked_list_t* list) {
 	if (!list)
 		return -NULL_ARG;
 
-	if (!read_lock(&list->cleanup_lock))
+	if (!read_lock_whole(list))
 		return -CLEANUP_PENDING;
 
 	pthread_mutex_lock(&list->size_lock);
 	int res = list->size;
 	pthread_mutex_unlock(&list->size_lock);
 
-	read_unlock(&list->cleanup_lock);
+	read_unlock_whole(list);
 	return res;
 }
 
+int list_stats(linked_list_t* list, list_stats_t* stats) {
+	if (!list || !stats)
+		return NULL_ARG;
+	if (!read_lock_whole(list))
+		return CLEANUP_PENDING;
+
+	pthread_mutex_lock(&list->size_lock);
+	stats->size = list->size;
+	pthread_mutex_unlock(&list->size_lock);
+	stats->coarse_mode = __atomic_load_n(&list->coarse, __ATOMIC_RELAXED);
+	stats->mode_switches = __atomic_load_n(&list->mode_switches,
+			__ATOMIC_RELAXED);
+	stats->cache_hits = stats->cache_misses = 0;
+	for (int i = 0; list->cache && i < CACHE_COUNTER_SLOTS; i++) {
+		stats->cache_hits += __atomic_load_n(&list->cache->counters[i].hits,
+				__ATOMIC_RELAXED);
+		stats->cache_misses += __atomic_load_n(&list->cache->counters[i].misses,
+				__ATOMIC_RELAXED);
+	}
+
+	read_unlock_whole(list);
+	return SUCCESS;
+}
+
 int list_update(linked_list_t* list, int key, void* data) {
 	if (!list)
 		return NULL_ARG;
+	trace_op_start(TRACE_UPDATE, key);
 	if (!read_lock(&list->cleanup_lock))
-		return CLEANUP_PENDING;
+		return trace_op_end(TRACE_UPDATE, key, CLEANUP_PENDING);
 
 	int res = SUCCESS;
-	node_t* to_update = find(list, key); //if found, node returns locked
-	if (!to_update) {
+	linked_list_t* shard = moved_to(list, key);
+	if (shard)
+		goto unlock_rw;
+	if (!may_contain(list, key)) {
 		res = NOT_FOUND;
 		goto unlock_rw;
 	}
-	to_update->data = data;
-	pthread_mutex_unlock(&to_update->lock);
+	mutex_t* found_lock;
+	int slot;
+	int coarse = enter_point_op(list);
+	if (coarse < 0) {
+		res = lock_failure;
+		goto unlock_rw;
+	}
+	node_t* to_update = find_indexed(list, key, coarse, &found_lock, &slot); //if found, node returns locked
+	if (!to_update && !lock_failure)
+		shard = moved_to(list, key); // maybe moved before find got to it
+	if (!to_update)
+		res = lock_failure ? lock_failure : NOT_FOUND;
+	else if (__atomic_load_n(&to_update->flags, __ATOMIC_RELAXED)
+			& NODE_INTRUSIVE)
+		res = INVALID_ARG; // data is the container
+	else if (!wait_for_readers(to_update) || !cache_invalidate(list, key))
+		res = lock_failure;
+	else {
+		key_changing(list, LIST_EVENT_UPDATE, key, data);
+		*data_of(to_update, slot) = data;
+	}
+	mutex_unlock_safe(found_lock);
+	exit_point_op(list);
+	publish_events();
 
 unlock_rw:
 	read_unlock(&list->cleanup_lock);
-	return res;
+	if (shard)
+		res = list_update(shard, key, data);
+	return trace_op_end(TRACE_UPDATE, key, res);
+}
+
+/* Runs compute_func without the lock policy of the calling op, which is not
+ * for ops of the callback (see publish_events) */
+static int run_compute(int (*compute_func)(void *), void* data) {
+	const lock_policy_t* policy = lock_policy;
+	int failure = lock_failure;
+	lock_policy = NULL;
+	int result = compute_func(data);
+	lock_policy = policy;
+	lock_failure = failure;
+	return result;
 }
 
 int list_compute(linked_list_t* list, int key,
 		int (*compute_func)(void *), int* result) {
 	if (!list || !result || !compute_func)
 		return NULL_ARG;
+	trace_op_start(TRACE_COMPUTE, key);
 	if (!read_lock(&list->cleanup_lock))
-		return CLEANUP_PENDING;
+		return trace_op_end(TRACE_COMPUTE, key, CLEANUP_PENDING);
 
 	int res = SUCCESS;
-	node_t* to_compute = find(list, key); //if found, node returns locked
-	if (!to_compute) {
+	unsigned long version = 0;
+	node_t* to_compute = NULL;
+	void* data = NULL;
+	linked_list_t* shard = moved_to(list, key);
+	if (shard)
+		goto unlock_rw;
+	cache_entry_t* hit = list->cache ? cache_lookup(list, key, 1, &version)
+			: NULL;
+	if (hit) { // a reader of the key's stripe, see cache_lookup
+		if (hit->present)
+			*result = run_compute(compute_func, hit->data);
+		else
+			res = NOT_FOUND;
+		cache_leave(list, key);
+		goto unlock_rw;
+	}
+	if (!may_contain(list, key)) {
 		res = NOT_FOUND;
+		goto fill_cache;
+	}
+	mutex_t* found_lock;
+	int slot;
+	int coarse = enter_point_op(list);
+	if (coarse < 0) {
+		res = lock_failure;
 		goto unlock_rw;
 	}
-	*result = compute_func(to_compute->data);
-	pthread_mutex_unlock(&to_compute->lock);
+	to_compute = find_indexed(list, key, coarse, &found_lock, &slot); //if found, node returns locked
+	if (!to_compute && !lock_failure)
+		shard = moved_to(list, key); // maybe moved before find got to it
+	if (!to_compute)
+		res = lock_failure ? lock_failure : NOT_FOUND;
+	else // runs compute_func as a reader, along with other computes of key
+		__atomic_add_fetch(&to_compute->flags, NODE_READER, __ATOMIC_RELAXED);
+	mutex_unlock_safe(found_lock);
+	exit_point_op(list);
+	if (to_compute) {
+		data = *data_of(to_compute, slot);
+		*result = run_compute(compute_func, data);
+		__atomic_sub_fetch(&to_compute->flags, NODE_READER, __ATOMIC_RELEASE);
+	}
+
+fill_cache:
+	if (list->cache && !shard && (res == SUCCESS || res == NOT_FOUND))
+		cache_fill(list, key, version, to_compute != NULL, data);
 
 unlock_rw:
 	read_unlock(&list->cleanup_lock);
-	return res;
+	if (shard)
+		res = list_compute(shard, key, compute_func, result);
+	return trace_op_end(TRACE_COMPUTE, key, res);
+}
+
+int list_upsert(linked_list_t* list, int key, void* data) {
+	if (!list)
+		return NULL_ARG;
+	trace_op_start(TRACE_UPSERT, key);
+	op_t op = { .key = key, .data = data, .op = UPSERT };
+	return trace_op_end(TRACE_UPSERT, key, run_single_op(list, &op));
+}
+
+int list_remove_get(linked_list_t* list, int key, void** data) {
+	if (!list || !data)
+		return NULL_ARG;
+	trace_op_start(TRACE_REMOVE_GET, key);
+	op_t op = { .key = key, .op = REMOVE_GET };
+	int res = run_single_op(list, &op);
+	if (res == SUCCESS)
+		*data = op.data;
+	return trace_op_end(TRACE_REMOVE_GET, key, res);
+}
+
+int list_cas_data(linked_list_t* list, int key, void* expected, void* data) {
+	if (!list)
+		return NULL_ARG;
+	trace_op_start(TRACE_CAS, key);
+	op_t op = { .key = key, .data = data, .op = CAS, .expected = expected };
+	return trace_op_end(TRACE_CAS, key, run_single_op(list, &op));
+}
+
+int list_get_or_insert(linked_list_t* list, int key, void* data,
+		void** found_data) {
+	if (!list || !found_data)
+		return NULL_ARG;
+	trace_op_start(TRACE_GET_OR_INSERT, key);
+	op_t op = { .key = key, .data = data, .op = GET_OR_INSERT };
+	int res = run_single_op(list, &op);
+	if (res == SUCCESS || res == ALREADY_IN_LIST)
+		*found_data = op.data;
+	return trace_op_end(TRACE_GET_OR_INSERT, key, res);
+}
+
+int list_peek_min(linked_list_t* list, int* key, void** data) {
+	if (!list)
+		return NULL_ARG;
+	trace_op_start(TRACE_PEEK_MIN, 0);
+	if (!read_lock_whole(list))
+		return trace_op_end(TRACE_PEEK_MIN, 0, CLEANUP_PENDING);
+
+	mutex_t *prev_lock, *next_lock;
+	int coarse = enter_point_op(list);
+	if (coarse < 0) {
+		read_unlock_whole(list);
+		return trace_op_end(TRACE_PEEK_MIN, 0, lock_failure);
+	}
+	closest_below_key(list, INT_MIN, coarse, &prev_lock, &next_lock);
+	node_t* current = lock_failure ? NULL : list->head; // locked, if exists
+	while (current && !keys_in(current) && current->next) { // empty frozen
+		if (!coarse) {
+			if (!acquire(&current->next->lock))
+				break;
+			pthread_mutex_unlock(prev_lock);
+			prev_lock = next_lock;
+			next_lock = &current->next->lock;
+		}
+		current = current->next;
+	}
+	int res = lock_failure ? lock_failure
+			: current && keys_in(current) ? SUCCESS : NOT_FOUND;
+	if (res == SUCCESS) {
+		frozen_node_t* frozen = as_frozen(current);
+		int slot = frozen ? frozen->begin : -1;
+		while (frozen && frozen_removed(frozen->seg, slot))
+			slot++;
+		if (key)
+			*key = frozen ? frozen_key(frozen->seg, slot) : current->key;
+		if (data)
+			*data = *data_of(current, slot);
+	}
+	mutex_unlock_safe(prev_lock);
+	mutex_unlock_safe(next_lock);
+	exit_point_op(list);
+
+	read_unlock_whole(list);
+	return trace_op_end(TRACE_PEEK_MIN, 0, res);
+}
+
+int list_pop_min(linked_list_t* list, int* key, void** data) {
+	if (!list)
+		return NULL_ARG;
+	trace_op_start(TRACE_POP_MIN, 0);
+	if (!read_lock_whole(list))
+		return trace_op_end(TRACE_POP_MIN, 0, CLEANUP_PENDING);
+
+	void* popped_data;
+	int res = pop_at(list, 0, 1, key, &popped_data) ? SUCCESS : NOT_FOUND;
+	if (res == SUCCESS && data)
+		*data = popped_data;
+
+	read_unlock_whole(list);
+	return trace_op_end(TRACE_POP_MIN, 0, res);
+}
+
+int list_pop_min_n(linked_list_t* list, int n, int* keys, void** datas) {
+	if (!list)
+		return -NULL_ARG;
+	if (n <= 0)
+		return -INVALID_ARG;
+	trace_op_start(TRACE_POP_MIN_N, n);
+	if (!read_lock_whole(list))
+		return trace_op_end(TRACE_POP_MIN_N, n, -CLEANUP_PENDING);
+
+	int res = pop_at(list, 0, n, keys, datas);
+
+	read_unlock_whole(list);
+	return trace_op_end(TRACE_POP_MIN_N, n, res);
+}
+
+int list_pop_min_spray(linked_list_t* list, int k, int* key, void** data) {
+	if (!list)
+		return NULL_ARG;
+	if (k <= 0)
+		return INVALID_ARG;
+	trace_op_start(TRACE_POP_MIN_SPRAY, k);
+	if (!read_lock_whole(list))
+		return trace_op_end(TRACE_POP_MIN_SPRAY, k, CLEANUP_PENDING);
+
+	if (!spray_seed)
+		spray_seed = (unsigned) (size_t) &spray_seed | 1; // differs per thread
+	void* popped_data;
+	int res = pop_at(list, rand_r(&spray_seed) % k, 1, key, &popped_data) ?
+			SUCCESS : NOT_FOUND;
+	if (res == SUCCESS && data)
+		*data = popped_data;
+
+	read_unlock_whole(list);
+	return trace_op_end(TRACE_POP_MIN_SPRAY, k, res);
+}
+
+/* Sorts pointers to ops into sorted, and returns how many workers
+ * list_batch would split them between */
+static int sort_batch(linked_list_t* list, op_t* ops, int num_ops,
+		op_t** sorted) {
+	for (int i = 0; i < num_ops; i++)
+		sorted[i] = &ops[i];
+	qsort(sorted, num_ops, sizeof(*sorted), compare_ops_by_key);
+
+	int num_groups = 1;
+	for (int i = 1; i < num_ops; i++)
+		num_groups += sorted[i]->key != sorted[i - 1]->key;
+	int num_workers = list->config.batch_workers;
+	if (num_workers <= 0)
+		num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_workers > num_groups)
+		num_workers = num_groups;
+	if (num_workers <= 0)
+		num_workers = 1;
+	return num_workers;
+}
+
+/* Splits sorted ops between num_workers workers, and applies them, each
+ * worker on its own thread - except for the first one with inline_first,
+ * which runs on the calling thread. threads and params have room for
+ * num_workers. */
+static void run_batch(linked_list_t* list, op_t** sorted, int num_ops,
+		int num_workers, pthread_t* threads, list_params_t* params,
+		int inline_first, void (*on_result)(int, const op_t*, void*),
+		void* ctx, const op_t* base) {
+	int num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	batch_start_t start = { .next_worker = num_workers - 1 };
+	pthread_mutex_init(&start.lock, NULL);
+	pthread_cond_init(&start.turn, NULL);
+
+	// about the same number of ops for everyone, but a key is never split
+	for (int i = 0, first = 0; i < num_workers; i++) {
+		int last = (long long) num_ops * (i + 1) / num_workers;
+		if (last < first)
+			last = first;
+		while (last > 0 && last < num_ops
+				&& sorted[last]->key == sorted[last - 1]->key)
+			last++;
+		params[i].list = list;
+		params[i].ops = &sorted[first];
+		params[i].num_ops = last - first;
+		params[i].start = &start;
+		params[i].worker = i;
+		params[i].cpu = list->config.batch_cpu_affinity && num_cpus > 0
+				&& !(inline_first && i == 0) ? i % num_cpus : -1;
+		params[i].thread_created = 0;
+		params[i].on_result = on_result;
+		params[i].ctx = ctx;
+		params[i].base = base;
+		first = last;
+	}
+	// the last range should start first, see wait_for_head_turn
+	for (int i = num_workers - 1; i >= 0; i--) {
+		if (!(inline_first && i == 0))
+			params[i].thread_created = !pthread_create(&threads[i], NULL,
+					run_op, &params[i]);
+		if (!params[i].thread_created)
+			run_op(&params[i]);
+	}
+	for (int i = 0; i < num_workers; i++) {
+		if (params[i].thread_created)
+			pthread_join(threads[i], NULL);
+	}
+	pthread_cond_destroy(&start.turn);
+	pthread_mutex_destroy(&start.lock);
 }
 
 void list_batch(linked_list_t* list, int num_ops, op_t* ops) {
 	if (!list || !ops || num_ops <= 0)
 		return;
-	pthread_t* threads;
-	list_params_t* params;
-	MALLOC_N_ORELSE(threads, num_ops, return);
-	MALLOC_N_ORELSE(params, num_ops, free(threads); return);
+	trace_op_start(TRACE_BATCH, num_ops);
+	capture_members(ops, num_ops);
+	if (!enter_whole_op(list)) {
+		// keys are spread over the shards: route every op on its own
+		for (int i = 0; i < num_ops; i++)
+			run_single_op(list, &ops[i]);
+		trace_op_end(TRACE_BATCH, num_ops, SUCCESS);
+		return;
+	}
+	// Group ops by key, and split the key space between workers
+	op_t** sorted;
+	pthread_t* threads = NULL;
+	list_params_t* params = NULL;
+	int res = MEM_ERROR;
+	MALLOC_N_ORELSE(sorted, num_ops, goto cleanup);
+	int num_workers = sort_batch(list, ops, num_ops, sorted);
+	MALLOC_N_ORELSE(threads, num_workers, goto cleanup);
+	MALLOC_N_ORELSE(params, num_workers, goto cleanup);
+	run_batch(list, sorted, num_ops, num_workers, threads, params, 0,
+			NULL, NULL, ops);
+	res = SUCCESS;
 
-	for (int i = 0; i < num_ops; i++) {
-		params[i].list = list;
-		params[i].op_param = &ops[i];
-		pthread_create(&threads[i], NULL, run_op, &params[i]); //TODO do something in case of failure
+cleanup:
+	free(params);
+	free(threads);
+	free(sorted);
+	exit_whole_op(list);
+	trace_op_end(TRACE_BATCH, num_ops, res);
+}
+
+list_batch_t* list_batch_alloc(int capacity) {
+	if (capacity <= 0)
+		capacity = BATCH_MIN_CAPACITY;
+	list_batch_t* batch;
+	MALLOC_ORELSE(batch, return NULL);
+	MALLOC_N_ORELSE(batch->ops, capacity, free(batch); return NULL);
+	MALLOC_N_ORELSE(batch->sorted, capacity, free(batch->ops); free(batch);
+			return NULL);
+	batch->num_ops = 0;
+	batch->capacity = capacity;
+	batch->threads = NULL;
+	batch->params = NULL;
+	batch->max_workers = 0;
+	return batch;
+}
+
+void list_batch_free(list_batch_t* batch) {
+	if (!batch)
+		return;
+	free(batch->params);
+	free(batch->threads);
+	free(batch->sorted);
+	free(batch->ops);
+	free(batch);
+}
+
+void list_batch_reset(list_batch_t* batch) {
+	if (batch)
+		batch->num_ops = 0;
+}
+
+int list_batch_add(list_batch_t* batch, const op_t* op) {
+	if (!batch || !op)
+		return -NULL_ARG;
+	if (batch->num_ops == batch->capacity) {
+		if (batch->capacity > INT_MAX / 2)
+			return -MEM_ERROR;
+		int capacity = batch->capacity * 2;
+		op_t* ops = realloc(batch->ops, sizeof(*ops) * capacity);
+		if (!ops)
+			return -MEM_ERROR;
+		batch->ops = ops;
+		op_t** sorted = realloc(batch->sorted, sizeof(*sorted) * capacity);
+		if (!sorted)
+			return -MEM_ERROR; // ops just stay bigger than needed
+		batch->sorted = sorted;
+		batch->capacity = capacity;
+	}
+	batch->ops[batch->num_ops] = *op;
+	return batch->num_ops++;
+}
+
+const op_t* list_batch_op(const list_batch_t* batch, int index) {
+	if (!batch || index < 0 || index >= batch->num_ops)
+		return NULL;
+	return &batch->ops[index];
+}
+
+int list_batch_run(linked_list_t* list, list_batch_t* batch,
+		void (*on_result)(int index, const op_t* op, void* ctx), void* ctx) {
+	if (!list || !batch)
+		return NULL_ARG;
+	int num_ops = batch->num_ops;
+	if (num_ops == 0)
+		return SUCCESS;
+	trace_op_start(TRACE_BATCH, num_ops);
+	capture_members(batch->ops, num_ops);
+	if (!enter_whole_op(list)) {
+		for (int i = 0; i < num_ops; i++) {
+			run_single_op(list, &batch->ops[i]);
+			if (on_result)
+				on_result(i, &batch->ops[i], ctx);
+		}
+		trace_op_end(TRACE_BATCH, num_ops, SUCCESS);
+		return SUCCESS;
+	}
+	int num_workers = sort_batch(list, batch->ops, num_ops, batch->sorted);
+	// small batches aren't worth a thread
+	int max_useful = (num_ops + BATCH_OPS_PER_WORKER - 1)
+			/ BATCH_OPS_PER_WORKER;
+	if (num_workers > max_useful)
+		num_workers = max_useful;
+	if (num_workers > batch->max_workers) {
+		pthread_t* threads = realloc(batch->threads,
+				sizeof(*threads) * num_workers);
+		if (threads)
+			batch->threads = threads;
+		list_params_t* params = threads ? realloc(batch->params,
+				sizeof(*params) * num_workers) : NULL;
+		if (!params) {
+			exit_whole_op(list);
+			trace_op_end(TRACE_BATCH, num_ops, MEM_ERROR);
+			return MEM_ERROR;
+		}
+		batch->params = params;
+		batch->max_workers = num_workers;
+	}
+	run_batch(list, batch->sorted, num_ops, num_workers, batch->threads,
+			batch->params, 1, on_result, ctx, batch->ops);
+	exit_whole_op(list);
+	trace_op_end(TRACE_BATCH, num_ops, SUCCESS);
+	return SUCCESS;
+}
+
+int list_txn(linked_list_t* list, op_t* ops, int num_ops) {
+	if (!list || !ops)
+		return NULL_ARG;
+	if (num_ops <= 0)
+		return INVALID_ARG;
+	trace_op_start(TRACE_TXN, num_ops);
+	capture_members(ops, num_ops);
+	if (!read_lock_whole(list))
+		return trace_op_end(TRACE_TXN, num_ops, CLEANUP_PENDING);
+	txn_t txn;
+	if (txn_prepare(&txn, ops, num_ops) != SUCCESS) {
+		read_unlock_whole(list);
+		return trace_op_end(TRACE_TXN, num_ops, MEM_ERROR);
+	}
+
+	int coarse = enter_point_op(list);
+	txn_lock_groups(list, &txn, coarse);
+	int res = SUCCESS, size_diff = 0;
+	for (int i = 0; i < num_ops && res == SUCCESS; i++)
+		if (txn_op_failed(&txn.work[i]))
+			res = txn.work[i].result;
+	if (res == SUCCESS)
+		size_diff = txn_apply(list, &txn);
+	for (int i = 0; i < txn.num_kept; i++)
+		pthread_mutex_unlock(txn.kept[i]);
+	exit_point_op(list);
+	publish_events();
+	if (size_diff) {
+		pthread_mutex_lock(&list->size_lock);
+		list->size += size_diff;
+		pthread_mutex_unlock(&list->size_lock);
 	}
+	for (int g = 0; g < txn.num_groups; g++)
+		if (txn.groups[g].removed)
+			retire_node(txn.groups[g].removed);
+	read_unlock_whole(list);
+
+	// results tell the caller why it aborted; outputs only come on commit
 	for (int i = 0; i < num_ops; i++) {
-		pthread_join(threads[i], NULL); // TODO should I check exit status?
+		ops[i].result = txn.work[i].result;
+		if (res != SUCCESS)
+			continue;
+		if (ops[i].op == COMPUTE && ops[i].result == SUCCESS)
+			*(int*) ops[i].data = txn.computed[i];
+		else if (ops[i].op == REMOVE_GET || ops[i].op == GET_OR_INSERT)
+			ops[i].data = txn.work[i].data;
 	}
-	free(params);
-	free(threads);
+	txn_free(&txn);
+	return trace_op_end(TRACE_TXN, num_ops, res);
+}
+
+/*------------------------ Try and timed point ops ---------------------------*/
+
+int list_try_insert(linked_list_t* list, int key, void* data) {
+	const lock_policy_t policy = { 1, NULL };
+	set_lock_policy(&policy);
+	int res = list_insert(list, key, data);
+	set_lock_policy(NULL);
+	return res;
+}
+
+int list_try_remove(linked_list_t* list, int key) {
+	const lock_policy_t policy = { 1, NULL };
+	set_lock_policy(&policy);
+	int res = list_remove(list, key);
+	set_lock_policy(NULL);
+	return res;
+}
+
+int list_try_find(linked_list_t* list, int key) {
+	const lock_policy_t policy = { 1, NULL };
+	set_lock_policy(&policy);
+	int res = list_find(list, key);
+	set_lock_policy(NULL);
+	return res;
+}
+
+int list_try_update(linked_list_t* list, int key, void* data) {
+	const lock_policy_t policy = { 1, NULL };
+	set_lock_policy(&policy);
+	int res = list_update(list, key, data);
+	set_lock_policy(NULL);
+	return res;
+}
+
+int list_try_compute(linked_list_t* list, int key,
+		int (*compute_func)(void *), int* result) {
+	const lock_policy_t policy = { 1, NULL };
+	set_lock_policy(&policy);
+	int res = list_compute(list, key, compute_func, result);
+	set_lock_policy(NULL);
+	return res;
+}
+
+int list_insert_timed(linked_list_t* list, int key, void* data,
+		const struct timespec* deadline) {
+	if (!deadline)
+		return NULL_ARG;
+	const lock_policy_t policy = { 0, deadline };
+	set_lock_policy(&policy);
+	int res = list_insert(list, key, data);
+	set_lock_policy(NULL);
+	return res;
+}
+
+int list_remove_timed(linked_list_t* list, int key,
+		const struct timespec* deadline) {
+	if (!deadline)
+		return NULL_ARG;
+	const lock_policy_t policy = { 0, deadline };
+	set_lock_policy(&policy);
+	int res = list_remove(list, key);
+	set_lock_policy(NULL);
+	return res;
+}
+
+int list_find_timed(linked_list_t* list, int key,
+		const struct timespec* deadline) {
+	if (!deadline)
+		return NULL_ARG;
+	const lock_policy_t policy = { 0, deadline };
+	set_lock_policy(&policy);
+	int res = list_find(list, key);
+	set_lock_policy(NULL);
+	return res;
+}
+
+int list_update_timed(linked_list_t* list, int key, void* data,
+		const struct timespec* deadline) {
+	if (!deadline)
+		return NULL_ARG;
+	const lock_policy_t policy = { 0, deadline };
+	set_lock_policy(&policy);
+	int res = list_update(list, key, data);
+	set_lock_policy(NULL);
+	return res;
+}
+
+int list_compute_timed(linked_list_t* list, int key,
+		int (*compute_func)(void *), int* result,
+		const struct timespec* deadline) {
+	if (!deadline)
+		return NULL_ARG;
+	const lock_policy_t policy = { 0, deadline };
+	set_lock_policy(&policy);
+	int res = list_compute(list, key, compute_func, result);
+	set_lock_policy(NULL);
+	return res;
+}
+
+int list_try_upsert(linked_list_t* list, int key, void* data) {
+	const lock_policy_t policy = { 1, NULL };
+	set_lock_policy(&policy);
+	int res = list_upsert(list, key, data);
+	set_lock_policy(NULL);
+	return res;
+}
+
+int list_try_remove_get(linked_list_t* list, int key, void** data) {
+	const lock_policy_t policy = { 1, NULL };
+	set_lock_policy(&policy);
+	int res = list_remove_get(list, key, data);
+	set_lock_policy(NULL);
+	return res;
+}
+
+int list_try_cas_data(linked_list_t* list, int key, void* expected,
+		void* data) {
+	const lock_policy_t policy = { 1, NULL };
+	set_lock_policy(&policy);
+	int res = list_cas_data(list, key, expected, data);
+	set_lock_policy(NULL);
+	return res;
+}
+
+int list_try_get_or_insert(linked_list_t* list, int key, void* data,
+		void** found_data) {
+	const lock_policy_t policy = { 1, NULL };
+	set_lock_policy(&policy);
+	int res = list_get_or_insert(list, key, data, found_data);
+	set_lock_policy(NULL);
+	return res;
+}
+
+int list_try_insert_node(linked_list_t* list, int key, list_hook_t* hook,
+		void* container) {
+	const lock_policy_t policy = { 1, NULL };
+	set_lock_policy(&policy);
+	int res = list_insert_node(list, key, hook, container);
+	set_lock_policy(NULL);
+	return res;
+}
+
+int list_try_remove_node(linked_list_t* list, int key, list_hook_t** hook) {
+	const lock_policy_t policy = { 1, NULL };
+	set_lock_policy(&policy);
+	int res = list_remove_node(list, key, hook);
+	set_lock_policy(NULL);
+	return res;
+}
+
+int list_try_peek_min(linked_list_t* list, int* key, void** data) {
+	const lock_policy_t policy = { 1, NULL };
+	set_lock_policy(&policy);
+	int res = list_peek_min(list, key, data);
+	set_lock_policy(NULL);
+	return res;
+}
+
+int list_upsert_timed(linked_list_t* list, int key, void* data,
+		const struct timespec* deadline) {
+	if (!deadline)
+		return NULL_ARG;
+	const lock_policy_t policy = { 0, deadline };
+	set_lock_policy(&policy);
+	int res = list_upsert(list, key, data);
+	set_lock_policy(NULL);
+	return res;
+}
+
+int list_remove_get_timed(linked_list_t* list, int key, void** data,
+		const struct timespec* deadline) {
+	if (!deadline)
+		return NULL_ARG;
+	const lock_policy_t policy = { 0, deadline };
+	set_lock_policy(&policy);
+	int res = list_remove_get(list, key, data);
+	set_lock_policy(NULL);
+	return res;
+}
+
+int list_cas_data_timed(linked_list_t* list, int key, void* expected,
+		void* data, const struct timespec* deadline) {
+	if (!deadline)
+		return NULL_ARG;
+	const lock_policy_t policy = { 0, deadline };
+	set_lock_policy(&policy);
+	int res = list_cas_data(list, key, expected, data);
+	set_lock_policy(NULL);
+	return res;
+}
+
+int list_get_or_insert_timed(linked_list_t* list, int key, void* data,
+		void** found_data, const struct timespec* deadline) {
+	if (!deadline)
+		return NULL_ARG;
+	const lock_policy_t policy = { 0, deadline };
+	set_lock_policy(&policy);
+	int res = list_get_or_insert(list, key, data, found_data);
+	set_lock_policy(NULL);
+	return res;
+}
+
+int list_insert_node_timed(linked_list_t* list, int key, list_hook_t* hook,
+		void* container, const struct timespec* deadline) {
+	if (!deadline)
+		return NULL_ARG;
+	const lock_policy_t policy = { 0, deadline };
+	set_lock_policy(&policy);
+	int res = list_insert_node(list, key, hook, container);
+	set_lock_policy(NULL);
+	return res;
+}
+
+int list_remove_node_timed(linked_list_t* list, int key, list_hook_t** hook,
+		const struct timespec* deadline) {
+	if (!deadline)
+		return NULL_ARG;
+	const lock_policy_t policy = { 0, deadline };
+	set_lock_policy(&policy);
+	int res = list_remove_node(list, key, hook);
+	set_lock_policy(NULL);
+	return res;
+}
+
+int list_peek_min_timed(linked_list_t* list, int* key, void** data,
+		const struct timespec* deadline) {
+	if (!deadline)
+		return NULL_ARG;
+	const lock_policy_t policy = { 0, deadline };
+	set_lock_policy(&policy);
+	int res = list_peek_min(list, key, data);
+	set_lock_policy(NULL);
+	return res;
+}
+
+/*-------------------------- Tracing and capture -----------------------------*/
+
+int list_trace_dump(const char* path) {
+	if (!path)
+		return NULL_ARG;
+#ifndef MY_LIST_TRACE
+	return INVALID_ARG;
+#else
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return INVALID_ARG;
+	pthread_mutex_lock(&trace_mutex);
+	uint64_t ticks = trace_now() - trace_start_ticks;
+	trace_file_header_t header = { TRACE_MAGIC, TRACE_VERSION,
+			trace_num_threads, 0, 1.0 };
+	if (trace_rings && ticks)
+		header.ns_per_tick = (double) (clock_ns() - trace_start_ns) / ticks;
+	int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	for (trace_ring_t* ring = trace_rings; ring && ok; ring = ring->next) {
+		uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		uint64_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+		trace_thread_header_t thread = { ring->thread, head - first, first };
+		ok = fwrite(&thread, sizeof(thread), 1, file) == 1;
+		// oldest events first: from first to the end of ring, then the rest
+		unsigned start = first % TRACE_RING_SIZE, count = head - first;
+		unsigned to_end = TRACE_RING_SIZE - start < count ?
+				TRACE_RING_SIZE - start : count;
+		ok = ok && fwrite(&ring->events[start], sizeof(trace_event_t), to_end,
+				file) == to_end;
+		ok = ok && fwrite(ring->events, sizeof(trace_event_t), count - to_end,
+				file) == count - to_end;
+	}
+	pthread_mutex_unlock(&trace_mutex);
+	ok = !fclose(file) && ok;
+	return ok ? SUCCESS : INVALID_ARG;
+#endif
+}
+
+int list_capture_start(const char* path) {
+	if (!path)
+		return NULL_ARG;
+	pthread_mutex_lock(&capture_mutex);
+	FILE* file = capture_file ? NULL : fopen(path, "wb");
+	capture_file_header_t header = { CAPTURE_MAGIC, CAPTURE_VERSION };
+	if (file && fwrite(&header, sizeof(header), 1, file) != 1) {
+		fclose(file);
+		file = NULL;
+	}
+	if (!file) { // or already capturing
+		pthread_mutex_unlock(&capture_mutex);
+		return INVALID_ARG;
+	}
+	capture_file = file;
+	capture_write_failed = 0;
+	capture_num_threads = 0;
+	capture_start_ns = clock_ns();
+	__atomic_add_fetch(&capture_generation, 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&capture_on, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&capture_mutex);
+	return SUCCESS;
 }
 
+int list_capture_stop() {
+	pthread_mutex_lock(&capture_mutex);
+	if (!capture_file) {
+		pthread_mutex_unlock(&capture_mutex);
+		return INVALID_ARG;
+	}
+	__atomic_store_n(&capture_on, 0, __ATOMIC_RELEASE);
+	while (capture_buffers) {
+		capture_buffer_t* buffer = capture_buffers;
+		capture_buffers = buffer->next;
+		capture_flush(buffer);
+		free(buffer);
+	}
+	int ok = !fclose(capture_file) && !capture_write_failed;
+	capture_file = NULL;
+	pthread_mutex_unlock(&capture_mutex);
+	return ok ? SUCCESS : INVALID_ARG;
+}
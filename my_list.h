@@ -1,28 +1,342 @@
 #ifndef __MYLIST_H_
 #define __MYLIST_H_
 
+#include <pthread.h>
+#include <time.h>
+
+/* Return codes of list calls (calls returning a count return them negated) */
+enum list_error {
+	SUCCESS = 0,
+	NULL_ARG = 2,
+	INVALID_ARG,
+	MEM_ERROR,
+	NOT_FOUND,
+	ALREADY_IN_LIST,
+	CLEANUP_PENDING,
+	DATA_MISMATCH,
+	BUSY,		// list_try_*: a lock was contended
+	TIMED_OUT	// list_*_timed: deadline passed waiting for a lock
+};
+
 struct linked_list_t;
 typedef struct linked_list_t linked_list_t;
 
+/* Hook of an intrusive node: embedded in the caller's object, so
+ * list_insert_node links the object without allocating. Fields belong to the
+ * list while the hook is linked, and its lock is initialized on insertion. */
+typedef struct list_hook_t
+{
+	int key;
+	int flags;
+	struct list_hook_t* next;
+	pthread_mutex_t lock;
+	void* data;
+} list_hook_t;
+
 typedef struct op_t
 {
 	int key;
 	void* data;
-	enum {INSERT, REMOVE, CONTAINS, UPDATE, COMPUTE} op;
+	enum {INSERT, REMOVE, CONTAINS, UPDATE, COMPUTE,
+		UPSERT, REMOVE_GET, CAS, GET_OR_INSERT} op;
 	int (*compute_func) (void *);
 	int result;
+	void* expected; // for CAS only
 } op_t;
 
+/* Optional list features. Zero initialized config means none of them. */
+typedef struct list_config_t
+{
+	/* Counting Bloom filter, which answers lookups of absent keys without
+	 * locking. Sized for bloom_expected_keys keys with bloom_fp_rate false
+	 * positive rate (about 1.44*log2(1/bloom_fp_rate) bytes per key).
+	 * 0 - no filter */
+	int bloom_expected_keys;
+	double bloom_fp_rate;
+	/* Switch at runtime between a single list-wide lock (when there's little
+	 * contention) and hand-over-hand node locking (under load). */
+	int adaptive_locking;
+	/* list_batch splits the batch into this many key ranges, and applies
+	 * each range by a single sweep on its own thread.
+	 * 0 - number of online CPUs */
+	int batch_workers;
+	/* Pin batch workers to CPUs (worker i to CPU i mod number of CPUs) */
+	int batch_cpu_affinity;
+	/* Hash index from key to node, with this many buckets, so list_find,
+	 * list_update and list_compute don't walk the list. 0 - no index */
+	int hash_index_buckets;
+	/* Per-thread cache of the last few hundred list_find and list_compute
+	 * results (of any list), so repeated lookups of hot keys skip the walk.
+	 * Hits are validated against versions of key stripes, which every
+	 * insertion, removal and update bumps, so they stay linearizable, but
+	 * writes of a key invalidate hits on about 1/1024 of the keys. */
+	int read_cache;
+} list_config_t;
+
+typedef struct list_stats_t
+{
+	int size;
+	int coarse_mode; // 1 - list-wide lock, 0 - hand-over-hand locking
+	unsigned long mode_switches;
+	unsigned long cache_hits, cache_misses; // of all threads, if read_cache
+} list_stats_t;
+
+typedef struct list_compact_stats_t
+{
+	int nodes; // visited
+	int moved;
+	/* Links from a node to the next one, which stay within a memory page,
+	 * before and after the pass (out of about nodes - 1) */
+	int local_links_before;
+	int local_links_after;
+} list_compact_stats_t;
+
 linked_list_t* list_alloc();
+linked_list_t* list_alloc_config(const list_config_t* config);
+/* Frees list and its nodes (not their data). Nodes of a large list are
+ * destroyed by several threads. */
 void list_free(linked_list_t* list);
+/* Like list_free, but nodes are destroyed on a background thread: list is
+ * gone once it returns, and done (unless NULL) is called with ctx, from
+ * that thread, once all nodes are. Hooks of intrusive nodes still in list
+ * are walked (and their next changed) by that thread until then, so their
+ * containers must stay valid until done is called. CLEANUP_PENDING if list
+ * is already being freed or split (then done isn't called). */
+int list_free_async(linked_list_t* list, void (*done)(void* ctx), void* ctx);
 int list_split(linked_list_t* list, int n, linked_list_t** arr);
+/* Splits list into n lists of consecutive key ranges (of about the same
+ * size), while list stays in use: its nodes are moved a few at a time, and
+ * point ops on list (including compound, intrusive, try/timed ops and
+ * batch) are redirected to the new list of their key, once it was moved.
+ * Ops on the whole list (size, stats, split, txn, for_each, reduce,
+ * remove_if, compact, freeze, peek/pop min) and batches already running are
+ * waited for first (so don't call it from their callbacks); after that, the
+ * ops fail on list with CLEANUP_PENDING, and batches run op by op. Returns
+ * when every node was moved. Then list only forwards ops: free it before
+ * the new lists. If list has less than n nodes, some new lists get none. */
+int list_split_online(linked_list_t* list, int n, linked_list_t** arr);
 int list_insert(linked_list_t* list, int key, void* data);
 int list_remove(linked_list_t* list, int key);
 int list_find(linked_list_t* list, int key);
 int list_size(linked_list_t* list);
+int list_stats(linked_list_t* list, list_stats_t* stats);
 int list_update(linked_list_t* list, int key, void* data);
+/* compute_func runs without the node locked, possibly along with other
+ * computes of the same key, so it may only read data. Ops which change data
+ * or remove the node wait for computes in progress to end. */
 int list_compute(linked_list_t* list, int key, 
 						int (*compute_func) (void *), int* result);
 void list_batch(linked_list_t* list, int num_ops, op_t* ops);
+/* Reusable batch. Ops are appended one by one into storage which the batch
+ * keeps, and list_batch_reset empties it in O(1), so running batches no
+ * bigger than the previous ones allocates nothing but the nodes of inserted
+ * keys. capacity is the initial number of ops (the batch grows past it). */
+typedef struct list_batch_t list_batch_t;
+list_batch_t* list_batch_alloc(int capacity);
+void list_batch_free(list_batch_t* batch);
+void list_batch_reset(list_batch_t* batch);
+/* Appends a copy of op. Returns its index in the batch, or a negative error
+ * code */
+int list_batch_add(list_batch_t* batch, const op_t* op);
+/* Op with its result and outputs after list_batch_run, or NULL */
+const op_t* list_batch_op(const list_batch_t* batch, int index);
+/* Applies the ops as list_batch does; small batches run on the calling
+ * thread. Unless on_result is NULL, it gets every op with its index as soon
+ * as the key range holding the op is applied and unlocked - from the thread
+ * which applied it, so possibly concurrently with other ranges. */
+int list_batch_run(linked_list_t* list, list_batch_t* batch,
+		void (*on_result)(int index, const op_t* op, void* ctx), void* ctx);
+/* Applies ops atomically: every op sees the list as left by the previous
+ * ones, and other threads see either none of them or all of them. The
+ * nodes of all keys, and the nodes before them, are locked in one sweep in
+ * key order, so transactions don't deadlock, and stay locked until it ends.
+ * So besides ops on its keys, every walk past its lowest key waits for the
+ * whole transaction: ops on higher keys (unless the hash index finds their
+ * node) and ops on the whole list; in coarse mode of adaptive locking, all
+ * ops wait. If an op fails (any result but SUCCESS, except for CONTAINS, and
+ * for GET_OR_INSERT which found the key), nothing is applied, and its
+ * result is returned; each op's result tells what it would have returned,
+ * and no other op field changes. */
+int list_txn(linked_list_t* list, op_t* ops, int num_ops);
+
+/* Point ops, which never wait for a lock: the list_try_* variants fail
+ * with BUSY on the first contended lock (or compute in the way), and the
+ * list_*_timed ones fail with TIMED_OUT once deadline (absolute
+ * CLOCK_REALTIME time, as in pthread_mutex_timedlock) passes. Locks already
+ * held are released, and the list is left unchanged. Like list_find, the
+ * find variants return 1 or 0 when they get to look, so BUSY and TIMED_OUT
+ * (as any error code) are above 1. compute_func runs as with list_compute:
+ * list ops it calls wait for locks as usual. Pops, batches and transactions
+ * have no such variants: they change many keys in one pass, and would fail
+ * with only some of them changed. */
+int list_try_insert(linked_list_t* list, int key, void* data);
+int list_try_remove(linked_list_t* list, int key);
+int list_try_find(linked_list_t* list, int key);
+int list_try_update(linked_list_t* list, int key, void* data);
+int list_try_compute(linked_list_t* list, int key,
+						int (*compute_func) (void *), int* result);
+int list_try_upsert(linked_list_t* list, int key, void* data);
+int list_try_remove_get(linked_list_t* list, int key, void** data);
+int list_try_cas_data(linked_list_t* list, int key, void* expected,
+						void* data);
+int list_try_get_or_insert(linked_list_t* list, int key, void* data,
+						void** found_data);
+int list_try_insert_node(linked_list_t* list, int key, list_hook_t* hook,
+						void* container);
+int list_try_remove_node(linked_list_t* list, int key, list_hook_t** hook);
+int list_try_peek_min(linked_list_t* list, int* key, void** data);
+int list_insert_timed(linked_list_t* list, int key, void* data,
+						const struct timespec* deadline);
+int list_remove_timed(linked_list_t* list, int key,
+						const struct timespec* deadline);
+int list_find_timed(linked_list_t* list, int key,
+						const struct timespec* deadline);
+int list_update_timed(linked_list_t* list, int key, void* data,
+						const struct timespec* deadline);
+int list_compute_timed(linked_list_t* list, int key,
+						int (*compute_func) (void *), int* result,
+						const struct timespec* deadline);
+int list_upsert_timed(linked_list_t* list, int key, void* data,
+						const struct timespec* deadline);
+int list_remove_get_timed(linked_list_t* list, int key, void** data,
+						const struct timespec* deadline);
+int list_cas_data_timed(linked_list_t* list, int key, void* expected,
+						void* data, const struct timespec* deadline);
+int list_get_or_insert_timed(linked_list_t* list, int key, void* data,
+						void** found_data, const struct timespec* deadline);
+int list_insert_node_timed(linked_list_t* list, int key, list_hook_t* hook,
+						void* container, const struct timespec* deadline);
+int list_remove_node_timed(linked_list_t* list, int key, list_hook_t** hook,
+						const struct timespec* deadline);
+int list_peek_min_timed(linked_list_t* list, int* key, void** data,
+						const struct timespec* deadline);
+
+/* Writes events traced so far by every thread (the last few thousands per
+ * thread) to file at path, in the format of my_list_trace.h. Decode it with
+ * my_list_trace_decode. Events of threads, which run list ops during the
+ * dump, may be torn. INVALID_ARG if file can't be written, or my_list.c
+ * wasn't compiled with -DMY_LIST_TRACE. */
+int list_trace_dump(const char* path);
+
+/* Workload capture: between list_capture_start and list_capture_stop,
+ * every op of any list (but list_free and the splits, and including try and
+ * timed variants, batch and txn) is logged (thread, time, op and key, not
+ * data) to file at path, in the format of my_list_trace.h. Replay it with
+ * my_list_replay. Start and stop while no list op runs.
+ * INVALID_ARG if file can't be written, or capture is already on (start)
+ * or off (stop). */
+int list_capture_start(const char* path);
+int list_capture_stop();
+
+/* Intrusive nodes: container (usually the object which embeds hook) is the
+ * node's data, so compute callbacks get it directly, and ops which would
+ * change it (update, upsert, cas_data, and their batch and txn ops) fail
+ * with INVALID_ARG. list_remove_node unlinks an intrusive node, and returns
+ * its hook. The list never frees hooks: removing them by other calls (or
+ * list_free) just unlinks them. A batch or txn which removes the key and
+ * inserts it again unlinks the hook, and links a new node. */
+int list_insert_node(linked_list_t* list, int key, list_hook_t* hook,
+						void* container);
+int list_remove_node(linked_list_t* list, int key, list_hook_t** hook);
+
+/* Single traversal compound operations */
+int list_upsert(linked_list_t* list, int key, void* data);
+int list_remove_get(linked_list_t* list, int key, void** data);
+int list_cas_data(linked_list_t* list, int key, void* expected, void* data);
+int list_get_or_insert(linked_list_t* list, int key, void* data,
+						void** found_data);
+
+/* Priority queue: the list is sorted, so the minimum is its 1st node.
+ * list_pop_min_n pops up to n minimal nodes, and returns their number
+ * (or a negative error code). list_pop_min_spray pops one of the k
+ * minimal nodes at random, so concurrent consumers rarely contend on the
+ * same nodes. Key and data outputs may be NULL. */
+int list_peek_min(linked_list_t* list, int* key, void** data);
+int list_pop_min(linked_list_t* list, int* key, void** data);
+int list_pop_min_n(linked_list_t* list, int n, int* keys, void** datas);
+int list_pop_min_spray(linked_list_t* list, int k, int* key, void** data);
+
+/* Removes every node, for which pred is non-zero, in a single pass.
+ * Data of removed nodes is passed to free_data, unless it's NULL.
+ * Returns number of removed nodes, or a negative error code. */
+int list_remove_if(linked_list_t* list,
+		int (*pred)(int key, void* data, void* ctx), void* ctx,
+		void (*free_data)(void* data));
+
+/* Moves nodes into contiguous, key ordered blocks of a page each, so walks
+ * of a list which churn scattered over the heap miss fewer cache lines and
+ * TLB entries. Runs a few hundred nodes at a time under hand-over-hand
+ * locking, so other ops go on meanwhile: call it from a thread of its own
+ * to compact in the background. Intrusive nodes, and nodes being computed
+ * on, stay where they are. A block is freed once all its nodes are, so
+ * churn after compaction holds on to some memory until the next pass.
+ * stats (may be NULL) tells how much locality improved. */
+int list_compact(linked_list_t* list, list_compact_stats_t* stats);
+
+/* Freezes runs of at least min_run consecutive nodes into read-only
+ * segments: sorted keys, delta-encoded in groups, and their data, at about
+ * 10 bytes per key instead of a 64 byte node, which are binary searched and
+ * scanned sequentially. For large lists (or parts of them) which are mostly
+ * read. Every op works on frozen keys as on any other: updates and removals
+ * change a segment in place, while an insert into its key range splits it
+ * there, and pieces left with a few keys go back to nodes, so write heavy
+ * ranges drift back to nodes. Pieces of segments join runs again (along
+ * with the nodes between them), and a later call merges them. Intrusive
+ * nodes, and nodes being computed on, aren't frozen. Frozen keys aren't in
+ * the hash index, so point ops walk to them. Runs like list_compact, a step
+ * at a time. Returns number of keys frozen into new segments, or a negative
+ * error code. */
+int list_freeze(linked_list_t* list, int min_run);
+
+/* Change feed: a subscription is told of every insertion, removal and data
+ * change of keys in [lo, hi], instead of polling for them. seq (unique
+ * within the list) orders the changes of a key. Events are delivered once
+ * the op released its node locks, on the op's thread, so events of ops on
+ * different threads may arrive out of seq order: to func (with ctx), or
+ * if func is NULL, to a queue of queue_size events (rounded up to a power
+ * of 2), which any thread drains by list_poll_events. Events which don't
+ * fit in the queue are counted by list_events_lost. func may run list
+ * ops, but it must not subscribe to or unsubscribe from list. Batches and
+ * transactions deliver only the net effect on each key. Keys moved by
+ * list_split_online aren't followed to the new lists. list_free frees
+ * remaining subscriptions. */
+typedef enum list_event_type_t {
+	LIST_EVENT_INSERT,
+	LIST_EVENT_REMOVE,
+	LIST_EVENT_UPDATE
+} list_event_type_t;
+
+typedef struct list_event_t
+{
+	unsigned long seq;
+	list_event_type_t type;
+	int key;
+	void* data; // new data, or removed data for LIST_EVENT_REMOVE
+} list_event_t;
+
+struct list_subscription_t;
+typedef struct list_subscription_t list_subscription_t;
+
+int list_subscribe(linked_list_t* list, int lo, int hi,
+		void (*func)(const list_event_t* event, void* ctx), void* ctx,
+		int queue_size, list_subscription_t** sub);
+/* Moves up to max_events queued events into events, oldest first.
+ * Returns their number, or a negative error code. */
+int list_poll_events(list_subscription_t* sub, list_event_t* events,
+		int max_events);
+unsigned long list_events_lost(list_subscription_t* sub);
+/* Once it returns, func of sub isn't running, and won't be called again */
+int list_unsubscribe(linked_list_t* list, list_subscription_t* sub);
+
+/* Calls func for every node, in key order within each of (up to) num_threads
+ * key ranges, which are visited in parallel. */
+int list_for_each(linked_list_t* list, int num_threads,
+		void (*func)(int key, void* data, void* ctx), void* ctx);
+/* Folds every range (starting from init) with reduce_func, in parallel,
+ * then merges results of the ranges with combine_func, into result. */
+int list_reduce(linked_list_t* list, int num_threads,
+		int (*reduce_func)(int acc, int key, void* data, void* ctx),
+		int (*combine_func)(int acc1, int acc2), void* ctx, int init,
+		int* result);
 
 #endif /* __MYLIST_ */
\ No newline at end of file
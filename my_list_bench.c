@@ -0,0 +1,364 @@
+/*
+ * my_list_bench.c
+ *
+ * Throughput of list operations on a list, whose nodes were inserted in
+ * random order (so neighbours in the list are far from each other in memory).
+ * With counters on, every phase also reports hardware events per op, read
+ * from Linux perf_event counters (of all threads of the phase, user space
+ * only): cycles, instructions, L1D and LLC load misses, dTLB load misses and
+ * branch misses. Events the CPU (or the kernel's perf_event_paranoid, or a
+ * VM) doesn't provide are reported as "-".
+ *
+ * Build (compare with and without prefetching):
+ *   gcc -O2 -pthread my_list.c my_list_bench.c -o bench
+ *   gcc -O2 -pthread -DMY_LIST_NO_PREFETCH my_list.c my_list_bench.c -o bench_np
+ * Run:
+ *   ./bench [list_size] [threads] [hash_index_buckets] [counters]
+ * counters - 1 to read hardware counters, 0 (default) for time only.
+ */
+
+#include "my_list.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define DEFAULT_LIST_SIZE 5000
+#define DEFAULT_THREADS 4
+#define LOOKUPS_PER_THREAD 2000
+#define BATCH_OPS 2000
+
+typedef struct bench_thread_t {
+	linked_list_t* list;
+	int list_size;
+	unsigned seed;
+} bench_thread_t;
+
+static double now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void shuffle(int* keys, int n, unsigned* seed) {
+	for (int i = n - 1; i > 0; i--) {
+		int j = rand_r(seed) % (i + 1);
+		int tmp = keys[i];
+		keys[i] = keys[j];
+		keys[j] = tmp;
+	}
+}
+
+/*------------------------------- Counters ---------------------------------*/
+
+#define CACHE_LOAD_MISSES(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) \
+		| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+typedef struct counter_t {
+	const char* name; // column header
+	uint32_t type;
+	uint64_t config;
+	int fd; // -1 - unavailable
+	uint64_t start[3]; // value, time enabled, time running at start_phase
+} counter_t;
+
+#ifdef __linux__
+static counter_t counters[] = {
+	{ .name = "cycles", .type = PERF_TYPE_HARDWARE,
+			.config = PERF_COUNT_HW_CPU_CYCLES, .fd = -1 },
+	{ .name = "instrs", .type = PERF_TYPE_HARDWARE,
+			.config = PERF_COUNT_HW_INSTRUCTIONS, .fd = -1 },
+	{ .name = "L1D-miss", .type = PERF_TYPE_HW_CACHE,
+			.config = CACHE_LOAD_MISSES(PERF_COUNT_HW_CACHE_L1D), .fd = -1 },
+	{ .name = "LLC-miss", .type = PERF_TYPE_HW_CACHE,
+			.config = CACHE_LOAD_MISSES(PERF_COUNT_HW_CACHE_LL), .fd = -1 },
+	{ .name = "dTLB-miss", .type = PERF_TYPE_HW_CACHE,
+			.config = CACHE_LOAD_MISSES(PERF_COUNT_HW_CACHE_DTLB), .fd = -1 },
+	{ .name = "br-miss", .type = PERF_TYPE_HARDWARE,
+			.config = PERF_COUNT_HW_BRANCH_MISSES, .fd = -1 },
+};
+#define NUM_COUNTERS ((int) (sizeof(counters) / sizeof(counters[0])))
+#else
+static counter_t counters[1];
+#define NUM_COUNTERS 0
+#endif
+
+static int counters_on;
+
+/* Opens the counters, which follow threads created later on, so a phase
+ * counts its threads too (once they're joined). They count all along, and
+ * phases take the difference: counts of exited threads can't be reset.
+ * @Return: number of available counters
+ */
+static int open_counters() {
+	int available = 0, error = ENOSYS;
+#ifdef __linux__
+	for (int i = 0; i < NUM_COUNTERS; i++) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = counters[i].type;
+		attr.config = counters[i].config;
+		attr.inherit = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+				| PERF_FORMAT_TOTAL_TIME_RUNNING;
+		counters[i].fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if (counters[i].fd >= 0)
+			available++;
+		else
+			error = errno;
+	}
+#endif
+	if (!available)
+		printf("hardware counters unavailable (%s), reporting time only\n\n",
+				strerror(error));
+	return available;
+}
+
+static void close_counters() {
+#ifdef __linux__
+	for (int i = 0; i < NUM_COUNTERS; i++)
+		if (counters[i].fd >= 0)
+			close(counters[i].fd);
+#endif
+}
+
+//@Return: 1 if values (value, time enabled, time running) were read
+static int read_values(int i, uint64_t* values) {
+#ifdef __linux__
+	return counters[i].fd >= 0
+			&& read(counters[i].fd, values, 3 * sizeof(uint64_t))
+					== 3 * sizeof(uint64_t);
+#else
+	return 0;
+#endif
+}
+
+//@Return: start time of the phase
+static double start_phase() {
+	for (int i = 0; counters_on && i < NUM_COUNTERS; i++)
+		if (!read_values(i, counters[i].start))
+			counters[i].start[2] = UINT64_MAX;
+	return now_ns();
+}
+
+/* Count of counter i since start_phase, scaled up for the time it wasn't
+ * scheduled on the PMU (when there are more counters than PMU registers).
+ * @Return: count, or -1 if it isn't available
+ */
+static double read_counter(int i) {
+	uint64_t values[3];
+	const uint64_t* start = counters[i].start;
+	if (start[2] == UINT64_MAX || !read_values(i, values)
+			|| values[2] == start[2])
+		return -1;
+	return (double) (values[0] - start[0]) * (values[1] - start[1])
+			/ (values[2] - start[2]);
+}
+
+//columns of counters, per op
+static void print_header() {
+	printf("%-24s %14s %18s", "", "", "");
+	for (int i = 0; i < NUM_COUNTERS; i++)
+		printf(" %10s", counters[i].name);
+	printf("\n");
+}
+
+static void report(const char* phase, int ops, double start_ns) {
+	double elapsed = now_ns() - start_ns;
+	double counts[NUM_COUNTERS + 1];
+	for (int i = 0; counters_on && i < NUM_COUNTERS; i++)
+		counts[i] = read_counter(i);
+	printf("%-24s %10d ops %12.1f ns/op", phase, ops, elapsed / ops);
+	for (int i = 0; counters_on && i < NUM_COUNTERS; i++) {
+		if (counts[i] < 0)
+			printf(" %10s", "-");
+		else
+			printf(" %10.2f", counts[i] / ops);
+	}
+	printf("\n");
+}
+
+/*-------------------------------- Phases ----------------------------------*/
+
+static int touch(void* data) {
+	return data != NULL;
+}
+
+static void* lookups(void* arg) {
+	bench_thread_t* params = (bench_thread_t*) arg;
+	int result;
+	for (int i = 0; i < LOOKUPS_PER_THREAD; i++) {
+		int key = rand_r(&params->seed) % params->list_size;
+		list_compute(params->list, key, touch, &result);
+	}
+	return NULL;
+}
+
+static void bench_single_thread(linked_list_t* list, int* keys, int n) {
+	double start = start_phase();
+	for (int i = 0; i < n; i++)
+		list_insert(list, keys[i], &keys[i]);
+	report("insert (random order)", n, start);
+
+	start = start_phase();
+	for (int i = 0; i < n; i++)
+		list_find(list, keys[i]);
+	report("find (hit)", n, start);
+
+	start = start_phase();
+	for (int i = 0; i < n; i++)
+		list_find(list, n + keys[i]);
+	report("find (miss)", n, start);
+
+	start = start_phase();
+	for (int i = 0; i < n; i++)
+		list_update(list, keys[i], &keys[n - 1 - i]);
+	report("update", n, start);
+}
+
+static void bench_threads(linked_list_t* list, int n, int num_threads) {
+	pthread_t threads[num_threads];
+	bench_thread_t params[num_threads];
+	double start = start_phase();
+	for (int i = 0; i < num_threads; i++) {
+		params[i].list = list;
+		params[i].list_size = n;
+		params[i].seed = i + 1;
+		pthread_create(&threads[i], NULL, lookups, &params[i]);
+	}
+	for (int i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+	report("compute (threaded)", num_threads * LOOKUPS_PER_THREAD, start);
+}
+
+typedef struct single_op_t {
+	linked_list_t* list;
+	op_t* op;
+} single_op_t;
+
+// the way list_batch used to run: a thread per op
+static void* run_single_op(void* arg) {
+	single_op_t* params = (single_op_t*) arg;
+	op_t* op = params->op;
+	op->result = op->op == UPDATE ? list_update(params->list, op->key, op->data)
+			: list_find(params->list, op->key);
+	return NULL;
+}
+
+static void fill_batch(op_t* ops, int num_ops, int n, unsigned* seed) {
+	for (int i = 0; i < num_ops; i++) {
+		ops[i].key = rand_r(seed) % n;
+		ops[i].data = &ops[i];
+		ops[i].op = i % 2 ? UPDATE : CONTAINS;
+		ops[i].compute_func = NULL;
+	}
+}
+
+static void bench_batch(linked_list_t* list, int n) {
+	unsigned seed = 3003;
+	op_t* ops = malloc(sizeof(*ops) * BATCH_OPS);
+	pthread_t* threads = malloc(sizeof(*threads) * BATCH_OPS);
+	single_op_t* params = malloc(sizeof(*params) * BATCH_OPS);
+	if (!ops || !threads || !params)
+		goto free_all;
+
+	fill_batch(ops, BATCH_OPS, n, &seed);
+	double start = start_phase();
+	list_batch(list, BATCH_OPS, ops);
+	report("batch (key ranges)", BATCH_OPS, start);
+
+	fill_batch(ops, BATCH_OPS, n, &seed);
+	start = start_phase();
+	for (int i = 0; i < BATCH_OPS; i++) {
+		params[i].list = list;
+		params[i].op = &ops[i];
+		pthread_create(&threads[i], NULL, run_single_op, &params[i]);
+	}
+	for (int i = 0; i < BATCH_OPS; i++)
+		pthread_join(threads[i], NULL);
+	report("batch (thread per op)", BATCH_OPS, start);
+
+free_all:
+	free(params);
+	free(threads);
+	free(ops);
+}
+
+static void bench_remove(linked_list_t* list, int* keys, int n) {
+	double start = start_phase();
+	for (int i = 0; i < n; i++)
+		list_remove(list, keys[i]);
+	report("remove", n, start);
+}
+
+// per node moved, of a list filled like the one of the other phases
+static void bench_split(const list_config_t* config, int* keys, int n,
+		int parts) {
+	linked_list_t* list = list_alloc_config(config);
+	linked_list_t** arr = malloc(sizeof(*arr) * parts);
+	if (!list || !arr)
+		goto free_all;
+	for (int i = 0; i < n; i++)
+		list_insert(list, keys[i], &keys[i]);
+	double start = start_phase();
+	int res = list_split(list, parts, arr);
+	report("split", n, start);
+	if (res == SUCCESS) {
+		list = NULL; // freed by list_split
+		for (int i = 0; i < parts; i++)
+			list_free(arr[i]);
+	}
+
+free_all:
+	if (list)
+		list_free(list);
+	free(arr);
+}
+
+int main(int argc, char** argv) {
+	int n = argc > 1 ? atoi(argv[1]) : DEFAULT_LIST_SIZE;
+	int num_threads = argc > 2 ? atoi(argv[2]) : DEFAULT_THREADS;
+	list_config_t config = {0};
+	config.hash_index_buckets = argc > 3 ? atoi(argv[3]) : 0;
+	counters_on = argc > 4 ? atoi(argv[4]) : 0;
+	unsigned seed = 2017;
+	if (n <= 0 || num_threads <= 0 || config.hash_index_buckets < 0) {
+		fprintf(stderr, "usage: %s [list_size] [threads] [hash_index_buckets]"
+				" [counters]\n", argv[0]);
+		return 1;
+	}
+	int* keys = malloc(sizeof(*keys) * n);
+	if (!keys)
+		return 1;
+	for (int i = 0; i < n; i++)
+		keys[i] = i;
+	shuffle(keys, n, &seed);
+
+	linked_list_t* list = list_alloc_config(&config);
+	if (!list)
+		return 1;
+	if (counters_on)
+		counters_on = open_counters() > 0;
+	if (counters_on)
+		print_header();
+	bench_single_thread(list, keys, n);
+	bench_threads(list, n, num_threads);
+	bench_batch(list, n);
+	bench_remove(list, keys, n);
+	bench_split(&config, keys, n, num_threads);
+	close_counters();
+	list_free(list);
+	free(keys);
+	return 0;
+}
@@ -0,0 +1,418 @@
+/*
+ * my_list_replay.c
+ *
+ * Replays a workload captured by list_capture_start: a thread per captured
+ * thread issues its ops in their captured order, at the captured pace or
+ * as fast as possible, then throughput and latency of every op are
+ * reported. Keys which the capture uses before inserting them are inserted
+ * first, so they're there as they were when the capture started. Intrusive
+ * node ops and list_remove_if are counted, but skipped: their hooks and
+ * predicates belong to the captured program.
+ *
+ * Build (against any build of my_list.c):
+ *   gcc -O2 -pthread my_list.c my_list_replay.c -o my_list_replay
+ * Run:
+ *   ./my_list_replay capture_file [speed] [hash_index_buckets]
+ * speed - 0 (default) as fast as possible, 1 the captured pace, 2 twice as
+ * fast, and so on.
+ */
+
+#include "my_list.h"
+#include "my_list_trace.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct replay_thread_t {
+	linked_list_t* list;
+	capture_record_t** records; // of this thread, in order
+	int num_records;
+	double speed;
+	uint64_t start_ns;
+	uint64_t* latencies[TRACE_NUM_OPS]; // ns, by op
+	int counts[TRACE_NUM_OPS];
+	int skipped;
+} replay_thread_t;
+
+/* First use of a key in the capture, to tell whether it was in list
+ * before the capture */
+typedef struct key_use_t {
+	int key;
+	uint64_t ts;
+	int seq;
+	int inserts;
+} key_use_t;
+
+static const char* const op_names[TRACE_NUM_OPS] = {
+	[TRACE_INSERT] = "insert", [TRACE_REMOVE] = "remove", [TRACE_FIND] = "find",
+	[TRACE_UPDATE] = "update", [TRACE_COMPUTE] = "compute",
+	[TRACE_BATCH] = "batch", [TRACE_TXN] = "txn", [TRACE_UPSERT] = "upsert",
+	[TRACE_REMOVE_GET] = "remove_get", [TRACE_CAS] = "cas_data",
+	[TRACE_GET_OR_INSERT] = "get_or_insert", [TRACE_INSERT_NODE] = "insert_node",
+	[TRACE_REMOVE_NODE] = "remove_node", [TRACE_PEEK_MIN] = "peek_min",
+	[TRACE_POP_MIN] = "pop_min", [TRACE_POP_MIN_N] = "pop_min_n",
+	[TRACE_POP_MIN_SPRAY] = "pop_min_spray", [TRACE_REMOVE_IF] = "remove_if",
+	[TRACE_FOR_EACH] = "for_each", [TRACE_REDUCE] = "reduce",
+	[TRACE_COMPACT] = "compact", [TRACE_FREEZE] = "freeze"
+};
+
+//whether key of op's records is a key (and not, say, the number of ops)
+static int has_key(int op) {
+	return op <= TRACE_COMPUTE || op == CAPTURE_MEMBER
+			|| (op >= TRACE_UPSERT && op <= TRACE_REMOVE_NODE);
+}
+
+static int replayable(int op) {
+	return op != TRACE_INSERT_NODE && op != TRACE_REMOVE_NODE
+			&& op != TRACE_REMOVE_IF;
+}
+
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int touch(void* data) {
+	return data != NULL;
+}
+
+static void visit(int key, void* data, void* ctx) {
+	(void) key;
+	(void) data;
+	(void) ctx;
+}
+
+static int count_key(int acc, int key, void* data, void* ctx) {
+	(void) key;
+	(void) data;
+	(void) ctx;
+	return acc + 1;
+}
+
+static int add(int acc1, int acc2) {
+	return acc1 + acc2;
+}
+
+static int compare_uses(const void* a, const void* b) {
+	const key_use_t *u1 = a, *u2 = b;
+	if (u1->key != u2->key)
+		return u1->key < u2->key ? -1 : 1;
+	if (u1->ts != u2->ts)
+		return u1->ts < u2->ts ? -1 : 1;
+	return u1->seq - u2->seq;
+}
+
+static int compare_latencies(const void* a, const void* b) {
+	uint64_t l1 = *(const uint64_t*) a, l2 = *(const uint64_t*) b;
+	return l1 < l2 ? -1 : l1 > l2;
+}
+
+//@Return: records of the capture (to be freed), or NULL
+static capture_record_t* read_capture(const char* path, int* num_records) {
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		perror(path);
+		return NULL;
+	}
+	capture_file_header_t header;
+	if (fread(&header, sizeof(header), 1, file) != 1
+			|| header.magic != CAPTURE_MAGIC || header.version != CAPTURE_VERSION) {
+		fprintf(stderr, "not a list capture (or of another version)\n");
+		fclose(file);
+		return NULL;
+	}
+	capture_record_t* records = NULL;
+	int count = 0, capacity = 0;
+	for (;;) {
+		if (count == capacity) {
+			capacity = capacity ? capacity * 2 : 4096;
+			capture_record_t* more = realloc(records, capacity * sizeof(*records));
+			if (!more) {
+				fprintf(stderr, "out of memory\n");
+				free(records);
+				fclose(file);
+				return NULL;
+			}
+			records = more;
+		}
+		if (fread(&records[count], sizeof(*records), 1, file) != 1)
+			break;
+		count++;
+	}
+	fclose(file);
+	*num_records = count;
+	return records;
+}
+
+static int is_insert(const capture_record_t* record) {
+	if (record->op == CAPTURE_MEMBER)
+		return record->member_op == INSERT || record->member_op == UPSERT
+				|| record->member_op == GET_OR_INSERT;
+	return record->op == TRACE_INSERT || record->op == TRACE_UPSERT
+			|| record->op == TRACE_GET_OR_INSERT;
+}
+
+/* Inserts keys whose first use in the capture isn't an insertion
+ * @Return: number of keys inserted, or -1 on error
+ */
+static int prefill(linked_list_t* list, capture_record_t* records,
+		int num_records) {
+	key_use_t* uses = malloc(num_records * sizeof(*uses) + 1);
+	if (!uses)
+		return -1;
+	int num_uses = 0, inserted = 0;
+	for (int i = 0; i < num_records; i++) {
+		if (!has_key(records[i].op) || !replayable(records[i].op))
+			continue; // key isn't a key, or isn't used
+		uses[num_uses++] = (key_use_t) { records[i].key, records[i].ts, i,
+				is_insert(&records[i]) };
+	}
+	qsort(uses, num_uses, sizeof(*uses), compare_uses);
+	for (int i = 0; i < num_uses; i++) {
+		if (i > 0 && uses[i].key == uses[i - 1].key)
+			continue;
+		// data is the 1st record of key, like the records replayed inserts use
+		if (!uses[i].inserts && list_insert(list, uses[i].key,
+				&records[uses[i].seq]) == SUCCESS)
+			inserted++;
+	}
+	free(uses);
+	return inserted;
+}
+
+/* Issues the op of records[*i] (with its members, if it's batch or txn),
+ * and advances *i past it.
+ * @Return: latency, in ns
+ */
+static uint64_t replay_op(replay_thread_t* thread, int* i) {
+	capture_record_t* record = thread->records[(*i)++];
+	linked_list_t* list = thread->list;
+	int key = record->key, result;
+	void* data;
+	op_t* ops = NULL;
+	int* results = NULL; // of computes in the batch
+	int num_ops = 0;
+	if (record->op == TRACE_BATCH || record->op == TRACE_TXN) {
+		ops = calloc(key > 0 ? key : 1, sizeof(*ops));
+		results = calloc(key > 0 ? key : 1, sizeof(*results));
+		while (ops && results && num_ops < key && *i < thread->num_records
+				&& thread->records[*i]->op == CAPTURE_MEMBER) {
+			capture_record_t* member = thread->records[(*i)++];
+			ops[num_ops].key = member->key;
+			ops[num_ops].op = member->member_op;
+			ops[num_ops].data = member->member_op == COMPUTE ?
+					(void*) &results[num_ops] : (void*) member;
+			ops[num_ops].compute_func = touch;
+			ops[num_ops].expected = member; // CAS succeeds if it wasn't updated
+			num_ops++;
+		}
+	}
+	uint64_t start = now_ns();
+	switch (record->op) {
+	case TRACE_INSERT:
+		list_insert(list, key, record);
+		break;
+	case TRACE_REMOVE:
+		list_remove(list, key);
+		break;
+	case TRACE_FIND:
+		list_find(list, key);
+		break;
+	case TRACE_UPDATE:
+		list_update(list, key, record);
+		break;
+	case TRACE_COMPUTE:
+		list_compute(list, key, touch, &result);
+		break;
+	case TRACE_BATCH:
+		if (num_ops)
+			list_batch(list, num_ops, ops);
+		break;
+	case TRACE_TXN:
+		if (num_ops)
+			list_txn(list, ops, num_ops);
+		break;
+	case TRACE_UPSERT:
+		list_upsert(list, key, record);
+		break;
+	case TRACE_REMOVE_GET:
+		list_remove_get(list, key, &data);
+		break;
+	case TRACE_CAS: // as CAS ops of batches
+		list_cas_data(list, key, record, record);
+		break;
+	case TRACE_GET_OR_INSERT:
+		list_get_or_insert(list, key, record, &data);
+		break;
+	case TRACE_PEEK_MIN:
+		list_peek_min(list, NULL, NULL);
+		break;
+	case TRACE_POP_MIN:
+		list_pop_min(list, NULL, NULL);
+		break;
+	case TRACE_POP_MIN_N:
+		list_pop_min_n(list, key, NULL, NULL);
+		break;
+	case TRACE_POP_MIN_SPRAY:
+		list_pop_min_spray(list, key, NULL, NULL);
+		break;
+	case TRACE_FOR_EACH:
+		list_for_each(list, key, visit, NULL);
+		break;
+	case TRACE_REDUCE:
+		list_reduce(list, key, count_key, add, NULL, 0, &result);
+		break;
+	case TRACE_COMPACT:
+		list_compact(list, NULL);
+		break;
+	case TRACE_FREEZE:
+		list_freeze(list, key);
+		break;
+	}
+	uint64_t latency = now_ns() - start;
+	free(results);
+	free(ops);
+	return latency;
+}
+
+static void* replay(void* arg) {
+	replay_thread_t* thread = (replay_thread_t*) arg;
+	for (int i = 0; i < thread->num_records;) {
+		capture_record_t* record = thread->records[i];
+		if (record->op >= TRACE_NUM_OPS || !op_names[record->op]) {
+			i++; // a member without its batch, or an op replay doesn't know
+			continue;
+		}
+		if (!replayable(record->op)) {
+			thread->skipped++;
+			i++;
+			continue;
+		}
+		if (thread->speed > 0) {
+			uint64_t due = thread->start_ns + record->ts / thread->speed;
+			uint64_t now = now_ns();
+			if (due > now) {
+				struct timespec wait = { (due - now) / 1000000000,
+						(due - now) % 1000000000 };
+				nanosleep(&wait, NULL);
+			}
+		}
+		int op = record->op;
+		thread->latencies[op][thread->counts[op]++] = replay_op(thread, &i);
+	}
+	return NULL;
+}
+
+static void report(replay_thread_t* threads, int num_threads, int total_ops,
+		uint64_t elapsed) {
+	int skipped = 0;
+	for (int t = 0; t < num_threads; t++)
+		skipped += threads[t].skipped;
+	printf("%d ops in %.3f s: %.0f ops/s\n", total_ops, elapsed / 1e9,
+			elapsed ? total_ops * 1e9 / elapsed : 0);
+	if (skipped)
+		printf("%d intrusive node and remove_if ops skipped\n", skipped);
+	printf("\n%-13s %10s %10s %10s %10s %10s\n", "op", "count", "mean(ns)",
+			"p50(ns)", "p99(ns)", "max(ns)");
+	for (int op = 0; op < TRACE_NUM_OPS; op++) {
+		int count = 0;
+		for (int t = 0; t < num_threads; t++)
+			count += threads[t].counts[op];
+		if (!count)
+			continue;
+		uint64_t* all = malloc(count * sizeof(*all));
+		if (!all)
+			return;
+		uint64_t total = 0;
+		for (int t = 0, n = 0; t < num_threads; t++)
+			for (int i = 0; i < threads[t].counts[op]; i++, n++)
+				total += all[n] = threads[t].latencies[op][i];
+		qsort(all, count, sizeof(*all), compare_latencies);
+		printf("%-13s %10d %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+				"\n", op_names[op], count, total / count, all[count / 2],
+				all[(long long) count * 99 / 100], all[count - 1]);
+		free(all);
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2 || argc > 4) {
+		fprintf(stderr, "usage: %s capture_file [speed] [hash_index_buckets]\n",
+				argv[0]);
+		return 1;
+	}
+	double speed = argc > 2 ? atof(argv[2]) : 0;
+	list_config_t config = {0};
+	config.hash_index_buckets = argc > 3 ? atoi(argv[3]) : 0;
+	int num_records, num_threads = 0, res = 1;
+	capture_record_t* records = read_capture(argv[1], &num_records);
+	if (!records)
+		return 1;
+	for (int i = 0; i < num_records; i++)
+		if (records[i].thread >= num_threads)
+			num_threads = records[i].thread + 1;
+
+	linked_list_t* list = list_alloc_config(&config);
+	replay_thread_t* threads = calloc(num_threads + 1, sizeof(*threads));
+	pthread_t* ids = calloc(num_threads + 1, sizeof(*ids));
+	if (!list || !threads || !ids)
+		goto free_all;
+	for (int i = 0; i < num_records; i++)
+		threads[records[i].thread].num_records++;
+	for (int t = 0; t < num_threads; t++) {
+		int n = threads[t].num_records;
+		threads[t].records = malloc((n + 1) * sizeof(*threads[t].records));
+		if (!threads[t].records)
+			goto free_all;
+		for (int op = 0; op < TRACE_NUM_OPS; op++)
+			if (!(threads[t].latencies[op] = malloc((n + 1) * sizeof(uint64_t))))
+				goto free_all;
+		threads[t].list = list;
+		threads[t].speed = speed;
+		threads[t].num_records = 0;
+	}
+	for (int i = 0; i < num_records; i++) {
+		replay_thread_t* thread = &threads[records[i].thread];
+		thread->records[thread->num_records++] = &records[i];
+	}
+	int prefilled = prefill(list, records, num_records);
+	if (prefilled < 0)
+		goto free_all;
+	printf("%d records of %d threads, %d keys prefilled\n", num_records,
+			num_threads, prefilled);
+
+	uint64_t start = now_ns();
+	for (int t = 0; t < num_threads; t++) {
+		threads[t].start_ns = start;
+		if (pthread_create(&ids[t], NULL, replay, &threads[t])) {
+			while (t-- > 0) // threads already started use threads and list
+				pthread_join(ids[t], NULL);
+			goto free_all;
+		}
+	}
+	for (int t = 0; t < num_threads; t++)
+		pthread_join(ids[t], NULL);
+	uint64_t elapsed = now_ns() - start;
+	int total_ops = 0;
+	for (int t = 0; t < num_threads; t++)
+		for (int op = 0; op < TRACE_NUM_OPS; op++)
+			total_ops += threads[t].counts[op];
+	report(threads, num_threads, total_ops, elapsed);
+	res = 0;
+
+free_all:
+	for (int t = 0; threads && t < num_threads; t++) {
+		free(threads[t].records);
+		for (int op = 0; op < TRACE_NUM_OPS; op++)
+			free(threads[t].latencies[op]);
+	}
+	free(ids);
+	free(threads);
+	if (list)
+		list_free(list);
+	free(records);
+	return res;
+}
@@ -372,10 +372,13 @@ int main(int argc, char** argv) {
 
 
 #include "my_list.h"
+#include "my_list_trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #define LIST_FOR_EACH(list) for(int i = 0; i < list_size((list)) ; ++i)
 
@@ -675,6 +678,1252 @@ bool testSequential2(){
 }
 
 
+static int firstChar(void* data){
+	return ((char*)data)[0];
+}
+
+bool testBatchCoalescing(){
+	linked_list_t* list = list_alloc();
+	int result = -1;
+	ASSERT_ZERO(list_insert(list,5,"Ned"));
+	op_t ops[] = {
+		{7, "Catelyn", INSERT},
+		{7, NULL, CONTAINS},
+		{5, "Eddard", UPDATE},
+		{7, NULL, REMOVE},
+		{7, NULL, CONTAINS},
+		{5, "Stark", UPDATE},
+		{5, &result, COMPUTE, firstChar},
+		{7, NULL, REMOVE},
+		{5, "Ned", INSERT},
+	};
+	int n = sizeof(ops) / sizeof(ops[0]);
+
+	list_batch(list,n,ops);
+	ASSERT_ZERO(ops[0].result);
+	ASSERT_TEST(ops[1].result == 1);
+	ASSERT_ZERO(ops[2].result);
+	ASSERT_ZERO(ops[3].result);
+	ASSERT_TEST(ops[4].result == 0);
+	ASSERT_ZERO(ops[5].result);
+	ASSERT_ZERO(ops[6].result);
+	ASSERT_TEST(result == 'S');
+	ASSERT_NON_ZERO(ops[7].result); // already removed by ops[3]
+	ASSERT_NON_ZERO(ops[8].result); // already in list
+
+	ASSERT_TEST(list_size(list) == 1);
+	ASSERT_TEST(list_find(list,7) == 0);
+	ASSERT_ZERO(list_compute(list,5,firstChar,&result));
+	ASSERT_TEST(result == 'S');
+	list_free(list);
+	return true;
+}
+
+
+static int sumKeys(int acc, int key, void* data, void* ctx){
+	return acc + key;
+}
+static int add(int a, int b){
+	return a + b;
+}
+static void countVowels(int key, void* data, void* ctx){
+	__sync_fetch_and_add((int*)ctx, youComputeNothing(data));
+}
+//the 1st key waits (up to 2 seconds) for the last one, visited by another
+//thread, and tells whether it came
+static void waitForLastKey(int key, void* data, void* ctx){
+	int* seen = ctx; // last key, last key by the 1st one
+	if(key == 0){
+		for(int i = 0; i < 2000 && !__atomic_load_n(&seen[0],__ATOMIC_SEQ_CST); ++i)
+			usleep(1000);
+		seen[1] = __atomic_load_n(&seen[0],__ATOMIC_SEQ_CST);
+	}else if(key == 9)
+		__atomic_store_n(&seen[0],1,__ATOMIC_SEQ_CST);
+}
+
+bool testForEachReduce(){
+	linked_list_t* list = list_alloc();
+	int keys_n = 100, sum = 0, result = -1, vowels = 0;
+	for(int i = 0; i < keys_n; ++i){
+		ASSERT_ZERO(list_insert(list,i*7,"Hodor"));
+		sum += i*7;
+	}
+	ASSERT_NON_ZERO(list_reduce(list,0,sumKeys,add,NULL,0,&result));
+	ASSERT_NON_ZERO(list_for_each(NULL,4,countVowels,&vowels));
+
+	for(int threads = 1; threads <= 8; ++threads){
+		ASSERT_ZERO(list_reduce(list,threads,sumKeys,add,NULL,0,&result));
+		ASSERT_TEST(result == sum);
+	}
+	ASSERT_ZERO(list_for_each(list,4,countVowels,&vowels));
+	ASSERT_TEST(vowels == 2*keys_n);
+	list_free(list);
+
+	// threads start at their range, not behind callbacks of the ones before
+	list_config_t config = {.hash_index_buckets = 64};
+	list = list_alloc_config(&config);
+	for(int i = 0; i < keys_n; ++i)
+		ASSERT_ZERO(list_insert(list,i*7,"Hodor"));
+	for(int threads = 1; threads <= 8; ++threads){
+		ASSERT_ZERO(list_reduce(list,threads,sumKeys,add,NULL,0,&result));
+		ASSERT_TEST(result == sum);
+	}
+	list_free(list);
+	list = list_alloc();
+	for(int i = 0; i < 10; ++i)
+		ASSERT_ZERO(list_insert(list,i,"Hodor"));
+	int seen[2] = {0};
+	ASSERT_ZERO(list_for_each(list,2,waitForLastKey,seen));
+	ASSERT_TEST(seen[1]);
+	list_free(list);
+
+	list = list_alloc();
+	ASSERT_ZERO(list_reduce(list,4,sumKeys,add,NULL,0,&result));
+	ASSERT_TEST(result == 0);
+	list_free(list);
+	return true;
+}
+
+
+bool testCompoundOps(){
+	linked_list_t* list = list_alloc();
+	void* data = NULL;
+	char *jon = "Jon", *aegon = "Aegon";
+	ASSERT_NON_ZERO(list_upsert(NULL,1,jon));
+	ASSERT_NON_ZERO(list_remove_get(list,1,NULL));
+	ASSERT_NON_ZERO(list_get_or_insert(list,1,jon,NULL));
+
+	ASSERT_ZERO(list_upsert(list,1,jon)); // inserted
+	ASSERT_TEST(list_size(list) == 1);
+	ASSERT_ZERO(list_upsert(list,1,aegon)); // updated
+	ASSERT_TEST(list_size(list) == 1);
+
+	ASSERT_NON_ZERO(list_cas_data(list,1,jon,jon)); // data is aegon
+	ASSERT_NON_ZERO(list_cas_data(list,2,jon,jon)); // not in list
+	ASSERT_ZERO(list_cas_data(list,1,aegon,jon));
+
+	ASSERT_NON_ZERO(list_get_or_insert(list,1,aegon,&data)); // already in list
+	ASSERT_TEST(data == jon);
+	ASSERT_ZERO(list_get_or_insert(list,2,aegon,&data));
+	ASSERT_TEST(data == aegon);
+	ASSERT_TEST(list_size(list) == 2);
+
+	ASSERT_ZERO(list_remove_get(list,1,&data));
+	ASSERT_TEST(data == jon);
+	ASSERT_NON_ZERO(list_remove_get(list,1,&data));
+	ASSERT_TEST(list_size(list) == 1);
+
+	op_t ops[] = {
+		{3, jon, UPSERT},
+		{3, aegon, CAS, NULL, -1, jon},
+		{3, NULL, REMOVE_GET},
+		{2, jon, GET_OR_INSERT},
+	};
+	list_batch(list,4,ops);
+	ASSERT_ZERO(ops[0].result);
+	ASSERT_ZERO(ops[1].result);
+	ASSERT_ZERO(ops[2].result);
+	ASSERT_TEST(ops[2].data == aegon);
+	ASSERT_NON_ZERO(ops[3].result);
+	ASSERT_TEST(ops[3].data == aegon);
+	ASSERT_TEST(list_size(list) == 1);
+	list_free(list);
+	return true;
+}
+
+
+static int isOdd(int key, void* data, void* ctx){
+	return key % 2;
+}
+static int isNotAbove(int key, void* data, void* ctx){
+	return key <= *(int*)ctx;
+}
+static void countFreed(void* data){
+	++*(int*)data;
+}
+
+bool testRemoveIf(){
+	linked_list_t* list = list_alloc();
+	int keys_n = 50, freed = 0, limit = 10;
+	ASSERT_TEST(list_remove_if(NULL,isOdd,NULL,NULL) < 0);
+	ASSERT_TEST(list_remove_if(list,NULL,NULL,NULL) < 0);
+	ASSERT_TEST(list_remove_if(list,isOdd,NULL,NULL) == 0);
+
+	for(int i = 0; i < keys_n; ++i)
+		ASSERT_ZERO(list_insert(list,i,&freed));
+	ASSERT_TEST(list_remove_if(list,isOdd,NULL,countFreed) == keys_n/2);
+	ASSERT_TEST(freed == keys_n/2);
+	ASSERT_TEST(list_size(list) == keys_n/2);
+	for(int i = 0; i < keys_n; ++i)
+		ASSERT_TEST(list_find(list,i) == !(i % 2));
+
+	ASSERT_TEST(list_remove_if(list,isNotAbove,&limit,NULL) == 6); // 0..10
+	ASSERT_TEST(list_find(list,10) == 0);
+	ASSERT_TEST(list_find(list,12) == 1);
+	ASSERT_TEST(list_size(list) == keys_n/2 - 6);
+	list_free(list);
+	return true;
+}
+
+
+bool testBloomFilter(){
+	list_config_t bad = { 100, 0 }, config = { 100, 0.01 };
+	ASSERT_TEST(list_alloc_config(&bad) == NULL);
+	linked_list_t* list = list_alloc_config(&config);
+	ASSERT_TEST(list != NULL);
+	int keys_n = 300, result;
+	void* data;
+
+	for(int i = 0; i < keys_n; ++i)
+		ASSERT_ZERO(list_insert(list,i*2,"Varys"));
+	for(int i = 0; i < keys_n; ++i){
+		ASSERT_TEST(list_find(list,i*2) == 1);
+		ASSERT_TEST(list_find(list,i*2+1) == 0);
+		ASSERT_NON_ZERO(list_remove(list,i*2+1));
+		ASSERT_NON_ZERO(list_update(list,i*2+1,"Littlefinger"));
+		ASSERT_NON_ZERO(list_compute(list,i*2+1,youComputeNothing,&result));
+		ASSERT_NON_ZERO(list_remove_get(list,i*2+1,&data));
+	}
+	for(int i = 0; i < keys_n; i += 2)
+		ASSERT_ZERO(list_remove(list,i*2));
+	for(int i = 0; i < keys_n; ++i)
+		ASSERT_TEST(list_find(list,i*2) == i % 2);
+	ASSERT_ZERO(list_compute(list,2,youComputeNothing,&result));
+	ASSERT_TEST(result == 1);
+
+	linked_list_t* arr[2];
+	ASSERT_ZERO(list_split(list,2,arr));
+	ASSERT_TEST(list_size(arr[0]) + list_size(arr[1]) == keys_n/2);
+	ASSERT_TEST(list_find(arr[0],2) == 1);
+	ASSERT_TEST(list_find(arr[1],6) == 1);
+	ASSERT_TEST(list_find(arr[0],4) == 0);
+	list_free(arr[0]);
+	list_free(arr[1]);
+	return true;
+}
+
+
+bool testAdaptiveLocking(){
+	list_config_t config = {0};
+	config.adaptive_locking = 1;
+	linked_list_t* list = list_alloc_config(&config);
+	list_stats_t stats;
+	int result;
+	ASSERT_NON_ZERO(list_stats(NULL,&stats));
+	ASSERT_NON_ZERO(list_stats(list,NULL));
+	ASSERT_ZERO(list_stats(list,&stats));
+	ASSERT_TEST(stats.coarse_mode == 0);
+
+	// a single thread never contends, so the list switches to coarse mode
+	for(int i = 0; i < 3000; ++i)
+		ASSERT_ZERO(list_insert(list,i,"Tyrion"));
+	ASSERT_ZERO(list_stats(list,&stats));
+	ASSERT_TEST(stats.coarse_mode == 1);
+	ASSERT_TEST(stats.mode_switches == 1);
+	ASSERT_TEST(stats.size == 3000);
+
+	for(int i = 0; i < 3000; i += 2){
+		ASSERT_ZERO(list_update(list,i,"Imp"));
+		ASSERT_ZERO(list_compute(list,i,youComputeNothing,&result));
+		ASSERT_TEST(result == 1);
+		ASSERT_ZERO(list_remove(list,i+1));
+		ASSERT_TEST(list_find(list,i+1) == 0);
+	}
+	ASSERT_TEST(list_size(list) == 1500);
+	list_free(list);
+	return true;
+}
+
+
+bool testBatchPartitioned(){
+	list_config_t config = {0};
+	config.batch_workers = 4;
+	config.batch_cpu_affinity = 1;
+	linked_list_t* list = list_alloc_config(&config);
+	int keys_n = 2000;
+	op_t ops[2*keys_n];
+	for(int i = 0; i < keys_n; i += 2)
+		ASSERT_ZERO(list_insert(list,i,"Arya"));
+
+	for(int i = 0; i < keys_n; ++i){
+		ops[i].key = keys_n - 1 - i; // descending, shouldn't matter
+		ops[i].data = "No one";
+		ops[i].op = ops[i].key % 2 ? INSERT : REMOVE;
+		ops[i].result = -1;
+		ops[keys_n + i].key = i;
+		ops[keys_n + i].op = CONTAINS;
+		ops[keys_n + i].result = -1;
+	}
+	list_batch(list,2*keys_n,ops);
+	for(int i = 0; i < keys_n; ++i){
+		ASSERT_ZERO(ops[i].result);
+		ASSERT_TEST(ops[keys_n + i].result == i % 2);
+		ASSERT_TEST(list_find(list,i) == i % 2);
+	}
+	ASSERT_TEST(list_size(list) == keys_n/2);
+	list_free(list);
+	return true;
+}
+
+
+bool testPriorityQueue(){
+	linked_list_t* list = list_alloc();
+	int keys[] = {50, 10, 40, 20, 30, 60, 70};
+	char* names[] = {"Cersei", "Jaime", "Tyrion", "Tywin", "Kevan", "Lancel", "Joffrey"};
+	int keys_n = 7, key, popped_keys[3];
+	void* data;
+	void* popped_data[3];
+	ASSERT_NON_ZERO(list_pop_min(list,&key,&data));
+	ASSERT_NON_ZERO(list_peek_min(list,&key,&data));
+	ASSERT_TEST(list_pop_min_n(list,0,NULL,NULL) < 0);
+	ASSERT_NON_ZERO(list_pop_min_spray(list,0,&key,&data));
+
+	for(int i = 0; i < keys_n; ++i)
+		ASSERT_ZERO(list_insert(list,keys[i],names[i]));
+	ASSERT_ZERO(list_peek_min(list,&key,&data));
+	ASSERT_TEST(key == 10 && data == names[1]);
+	ASSERT_ZERO(list_pop_min(list,&key,&data));
+	ASSERT_TEST(key == 10 && data == names[1]);
+	ASSERT_TEST(list_size(list) == keys_n - 1);
+
+	ASSERT_TEST(list_pop_min_n(list,3,popped_keys,popped_data) == 3);
+	ASSERT_TEST(popped_keys[0] == 20 && popped_keys[1] == 30 && popped_keys[2] == 40);
+	ASSERT_TEST(popped_data[2] == names[2]);
+
+	ASSERT_ZERO(list_pop_min_spray(list,2,&key,&data)); // 50 or 60
+	ASSERT_TEST(key == 50 || key == 60);
+	ASSERT_TEST(list_find(list,key) == 0);
+	ASSERT_ZERO(list_pop_min_spray(list,100,&key,NULL)); // k above size is fine
+	ASSERT_TEST(list_size(list) == 1);
+	ASSERT_TEST(list_pop_min_n(list,3,NULL,NULL) == 1);
+	ASSERT_TEST(list_size(list) == 0);
+	list_free(list);
+	return true;
+}
+
+
+bool testHashIndex(){
+	list_config_t config = {0};
+	config.hash_index_buckets = 7; // few buckets, so they hold many keys
+	linked_list_t* list = list_alloc_config(&config);
+	ASSERT_TEST(list != NULL);
+	int keys_n = 200, limit = 10, result;
+
+	for(int i = keys_n - 1; i >= 0; --i)
+		ASSERT_ZERO(list_insert(list,i*2,"Bran"));
+	for(int i = 0; i < keys_n; ++i){
+		ASSERT_TEST(list_find(list,i*2) == 1);
+		ASSERT_TEST(list_find(list,i*2+1) == 0);
+		ASSERT_ZERO(list_update(list,i*2,"Hodor"));
+		ASSERT_NON_ZERO(list_update(list,i*2+1,"Hodor"));
+		ASSERT_ZERO(list_compute(list,i*2,firstChar,&result));
+		ASSERT_TEST(result == 'H');
+	}
+	//every way of unlinking nodes must unindex them
+	ASSERT_ZERO(list_remove(list,0));
+	ASSERT_ZERO(list_pop_min(list,&result,NULL));
+	ASSERT_TEST(result == 2);
+	ASSERT_TEST(list_remove_if(list,isNotAbove,&limit,NULL) == 4);
+	op_t ops[2] = {{ 12, NULL, REMOVE }, { 12, "Rickon", INSERT }};
+	list_batch(list,2,ops);
+	ASSERT_ZERO(list_compute(list,12,firstChar,&result));
+	ASSERT_TEST(result == 'R');
+	for(int i = 0; i <= limit; ++i)
+		ASSERT_TEST(list_find(list,i) == 0);
+	ASSERT_TEST(list_size(list) == keys_n - 6);
+
+	linked_list_t* arr[2];
+	ASSERT_ZERO(list_split(list,2,arr));
+	ASSERT_TEST(list_find(arr[0],12) == 1);
+	ASSERT_TEST(list_find(arr[1],14) == 1);
+	ASSERT_TEST(list_find(arr[0],14) == 0);
+	list_free(arr[0]);
+	list_free(arr[1]);
+	return true;
+}
+
+
+typedef struct direwolf_t {
+	char name[16];
+	list_hook_t hook;
+} direwolf_t;
+
+static int nameLength(void* data){
+	return strlen(((direwolf_t*)data)->name);
+}
+
+bool testIntrusiveNodes(){
+	linked_list_t* list = list_alloc();
+	direwolf_t wolves[5] = {{"Ghost"}, {"Nymeria"}, {"Summer"}, {"Shaggydog"},
+			{"Grey Wind"}};
+	list_hook_t* hook;
+	int result;
+	ASSERT_NON_ZERO(list_insert_node(NULL,1,&wolves[0].hook,&wolves[0]));
+	ASSERT_NON_ZERO(list_insert_node(list,1,NULL,&wolves[0]));
+	ASSERT_NON_ZERO(list_remove_node(list,1,NULL));
+
+	for(int i = 0; i < 4; ++i)
+		ASSERT_ZERO(list_insert_node(list,i*2,&wolves[i].hook,&wolves[i]));
+	ASSERT_NON_ZERO(list_insert_node(list,0,&wolves[4].hook,&wolves[4]));
+	ASSERT_ZERO(list_insert(list,1,"Lady"));
+	ASSERT_TEST(list_size(list) == 5);
+	ASSERT_ZERO(list_compute(list,2,nameLength,&result));
+	ASSERT_TEST(result == 7);
+
+	ASSERT_NON_ZERO(list_remove_node(list,1,&hook)); // allocated by list
+	ASSERT_NON_ZERO(list_remove_node(list,3,&hook));
+	ASSERT_ZERO(list_remove_node(list,2,&hook));
+	ASSERT_TEST(hook == &wolves[1].hook);
+	ASSERT_TEST(list_find(list,2) == 0);
+	ASSERT_ZERO(list_remove(list,4)); // just unlinked
+	ASSERT_ZERO(list_insert_node(list,5,&wolves[1].hook,&wolves[1])); // reused
+	ASSERT_ZERO(list_insert_node(list,4,&wolves[2].hook,&wolves[2]));
+
+	linked_list_t* arr[2];
+	ASSERT_ZERO(list_split(list,2,arr)); // hooks move along
+	ASSERT_TEST(list_size(arr[0]) == 3 && list_size(arr[1]) == 2);
+	ASSERT_ZERO(list_remove_node(arr[0],0,&hook));
+	ASSERT_TEST(hook == &wolves[0].hook);
+	ASSERT_ZERO(list_compute(arr[0],4,nameLength,&result));
+	ASSERT_TEST(result == 6);
+	list_free(arr[0]);
+	list_free(arr[1]);
+	return true;
+}
+
+
+bool testIntrusiveReplace(){
+	linked_list_t* list = list_alloc();
+	direwolf_t wolves[3] = {{"Ghost"}, {"Nymeria"}, {"Summer"}};
+	list_hook_t* hook;
+	for(int i = 0; i < 3; ++i)
+		ASSERT_ZERO(list_insert_node(list,i,&wolves[i].hook,&wolves[i]));
+	//the container can't be changed
+	ASSERT_TEST(list_update(list,0,"Lady") == INVALID_ARG);
+	ASSERT_TEST(list_upsert(list,0,"Lady") == INVALID_ARG);
+	ASSERT_TEST(list_cas_data(list,0,&wolves[0],"Lady") == INVALID_ARG);
+	op_t update = {.key = 0, .data = "Lady", .op = UPDATE};
+	list_batch(list,1,&update);
+	ASSERT_TEST(update.result == INVALID_ARG);
+	ASSERT_TEST(list_txn(list,&update,1) == INVALID_ARG);
+
+	//removed and inserted again: the hook is unlinked, a new node takes it
+	op_t ops[4] = {{.key = 1, .op = REMOVE}, {.key = 1, .data = "Lady", .op = INSERT},
+			{.key = 2, .op = REMOVE}, {.key = 2, .data = "Lady", .op = INSERT}};
+	list_batch(list,2,ops);
+	ASSERT_ZERO(ops[0].result);
+	ASSERT_ZERO(ops[1].result);
+	ASSERT_ZERO(list_txn(list,&ops[2],2));
+	ASSERT_TEST(list_size(list) == 3);
+	for(int i = 1; i < 3; ++i){
+		ASSERT_TEST(list_remove_node(list,i,&hook) == INVALID_ARG);
+		ASSERT_ZERO(list_update(list,i,"Ghost"));
+	}
+	list_free(list);
+	//the hooks are free to go in another list
+	list = list_alloc();
+	for(int i = 1; i < 3; ++i)
+		ASSERT_ZERO(list_insert_node(list,i,&wolves[i].hook,&wolves[i]));
+	ASSERT_TEST(list_size(list) == 2);
+	list_free(list);
+	return true;
+}
+
+static int computing, may_finish;
+static int waitForRelease(void* data){
+	__atomic_store_n(&computing,1,__ATOMIC_SEQ_CST);
+	while(!__atomic_load_n(&may_finish,__ATOMIC_SEQ_CST))
+		usleep(1000);
+	return 0;
+}
+static void waitAtFive(int key, void* data, void* ctx){
+	if(key == 5)
+		waitForRelease(data);
+}
+static void* holdNode(void* list){
+	list_for_each(list,1,waitAtFive,NULL); // keeps nodes 3 and 5 locked
+	return NULL;
+}
+static void* readNode(void* list){
+	int result;
+	list_compute(list,5,waitForRelease,&result); // node 5 has a reader
+	return NULL;
+}
+static void* readCachedNode(void* list){
+	int result;
+	list_find(list,5); // the compute hits this thread's cache
+	list_compute(list,5,waitForRelease,&result);
+	return NULL;
+}
+static linked_list_t* computed_list;
+static int computed_found;
+static int findAfterRelease(void* data){
+	__atomic_store_n(&may_finish,1,__ATOMIC_SEQ_CST);
+	//ops of the callback don't inherit the policy of the compute: this one
+	//waits for the holder to leave
+	computed_found = list_find(computed_list,7);
+	return 0;
+}
+static void startHolder(pthread_t* holder, void* (*hold)(void*), void* list){
+	computing = may_finish = 0;
+	pthread_create(holder,NULL,hold,list);
+	while(!__atomic_load_n(&computing,__ATOMIC_SEQ_CST))
+		usleep(1000);
+}
+static void stopHolder(pthread_t holder){
+	__atomic_store_n(&may_finish,1,__ATOMIC_SEQ_CST);
+	pthread_join(holder,NULL);
+}
+static void deadlineIn(struct timespec* deadline, long ms){
+	clock_gettime(CLOCK_REALTIME,deadline);
+	deadline->tv_sec += ms / 1000;
+	deadline->tv_nsec += ms % 1000 * 1000 * 1000;
+	if(deadline->tv_nsec >= 1000000000){
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000;
+	}
+}
+
+bool testTryAndTimed(){
+	linked_list_t* list = list_alloc();
+	struct timespec deadline;
+	pthread_t holder;
+	list_hook_t hook, *removed;
+	void* data;
+	char* arya = "Arya";
+	int result, key;
+	for(int i = 1; i < 10; i += 2)
+		ASSERT_ZERO(list_insert(list,i,"Jaqen"));
+	ASSERT_NON_ZERO(list_find_timed(list,1,NULL));
+	ASSERT_TEST(list_try_find(list,5) == 1);
+
+	startHolder(&holder,holdNode,list);
+	ASSERT_TEST(list_try_find(list,1) == 1); // walk ends before node 3
+	ASSERT_TEST(list_try_find(list,5) == BUSY);
+	ASSERT_TEST(list_try_insert(list,8,"Arya") == BUSY);
+	ASSERT_TEST(list_try_remove(list,9) == BUSY);
+	ASSERT_TEST(list_try_update(list,7,"Arya") == BUSY);
+	ASSERT_TEST(list_try_compute(list,5,youComputeNothing,&result) == BUSY);
+	ASSERT_TEST(list_try_upsert(list,7,"Arya") == BUSY);
+	ASSERT_TEST(list_try_remove_get(list,9,&data) == BUSY);
+	ASSERT_TEST(list_try_cas_data(list,7,"Jaqen","Arya") == BUSY);
+	ASSERT_TEST(list_try_get_or_insert(list,6,"Arya",&data) == BUSY);
+	ASSERT_TEST(list_try_insert_node(list,8,&hook,&hook) == BUSY);
+	ASSERT_TEST(list_try_remove_node(list,9,&removed) == BUSY);
+	ASSERT_ZERO(list_try_peek_min(list,&key,&data)); // head isn't held
+	ASSERT_TEST(key == 1);
+	deadlineIn(&deadline,20);
+	ASSERT_TEST(list_find_timed(list,7,&deadline) == TIMED_OUT);
+	ASSERT_TEST(list_insert_timed(list,6,"Arya",&deadline) == TIMED_OUT);
+	ASSERT_TEST(list_upsert_timed(list,6,"Arya",&deadline) == TIMED_OUT);
+	ASSERT_TEST(list_insert_node_timed(list,6,&hook,&hook,&deadline)
+			== TIMED_OUT);
+	ASSERT_TEST(list_remove_timed(list,1,&deadline) == SUCCESS);
+	stopHolder(holder);
+
+	//a walk from the head waits for the 1st node
+	linked_list_t* queue = list_alloc();
+	ASSERT_ZERO(list_insert(queue,5,"Jaqen"));
+	startHolder(&holder,holdNode,queue);
+	ASSERT_TEST(list_try_peek_min(queue,&key,&data) == BUSY);
+	deadlineIn(&deadline,20);
+	ASSERT_TEST(list_peek_min_timed(queue,&key,&data,&deadline) == TIMED_OUT);
+	stopHolder(holder);
+	ASSERT_ZERO(list_peek_min_timed(queue,&key,&data,&deadline));
+	ASSERT_TEST(key == 5);
+	list_free(queue);
+
+	//the compute callback runs without the policy of list_try_compute
+	computed_list = list_alloc();
+	for(int i = 1; i < 9; i += 2)
+		ASSERT_ZERO(list_insert(computed_list,i,"Jaqen"));
+	startHolder(&holder,holdNode,computed_list);
+	ASSERT_ZERO(list_try_compute(computed_list,1,findAfterRelease,&result));
+	ASSERT_TEST(computed_found == 1);
+	stopHolder(holder);
+	list_free(computed_list);
+
+	//a compute only keeps writers of its node waiting
+	startHolder(&holder,readNode,list);
+	ASSERT_TEST(list_try_find(list,5) == 1);
+	ASSERT_ZERO(list_try_compute(list,5,youComputeNothing,&result));
+	ASSERT_TEST(list_try_update(list,5,"Arya") == BUSY);
+	ASSERT_TEST(list_try_remove(list,5) == BUSY);
+	ASSERT_TEST(list_try_upsert(list,5,"Arya") == BUSY);
+	ASSERT_TEST(list_try_remove_get(list,5,&data) == BUSY);
+	ASSERT_TEST(list_try_get_or_insert(list,5,"Arya",&data)
+			== ALREADY_IN_LIST); // changes nothing
+	deadlineIn(&deadline,20);
+	ASSERT_TEST(list_update_timed(list,5,"Arya",&deadline) == TIMED_OUT);
+	ASSERT_TEST(list_remove_get_timed(list,5,&data,&deadline) == TIMED_OUT);
+	ASSERT_ZERO(list_try_update(list,7,"Arya"));
+	stopHolder(holder);
+
+	//nothing was left locked or half done
+	ASSERT_TEST(list_size(list) == 4);
+	ASSERT_ZERO(list_try_insert(list,8,"Arya"));
+	ASSERT_ZERO(list_try_remove(list,9));
+	deadline.tv_sec += 60;
+	ASSERT_ZERO(list_update_timed(list,7,"Arya",&deadline));
+	ASSERT_ZERO(list_compute_timed(list,5,youComputeNothing,&result,&deadline));
+	ASSERT_ZERO(list_remove_timed(list,5,&deadline));
+	ASSERT_TEST(list_find_timed(list,6,&deadline) == 0);
+	ASSERT_ZERO(list_try_upsert(list,6,arya));
+	ASSERT_ZERO(list_cas_data_timed(list,6,arya,"Jaqen",&deadline));
+	ASSERT_ZERO(list_try_remove_get(list,6,&data));
+	ASSERT_TEST(list_get_or_insert_timed(list,6,"Arya",&data,&deadline)
+			== SUCCESS);
+	ASSERT_ZERO(list_try_insert_node(list,2,&hook,&hook));
+	ASSERT_ZERO(list_remove_node_timed(list,2,&removed,&deadline));
+	ASSERT_TEST(removed == &hook);
+	ASSERT_TEST(list_size(list) == 4);
+	list_free(list);
+	return true;
+}
+
+
+#define ACCOUNTS 8
+#define BALANCE 100
+static void* transfer(void* list){
+	unsigned seed = (unsigned)(long)pthread_self();
+	for(int i = 0; i < 300; ++i){
+		int from = rand_r(&seed) % ACCOUNTS, to = (from + 1) % ACCOUNTS;
+		op_t read[2] = {{ from, NULL, GET_OR_INSERT }, { to, NULL, GET_OR_INSERT }};
+		if(list_txn(list,read,2))
+			return list;
+		long a = (long)read[0].data, b = (long)read[1].data;
+		op_t move[2] = {{ from, (void*)(a - 1), CAS }, { to, (void*)(b + 1), CAS }};
+		move[0].expected = read[0].data;
+		move[1].expected = read[1].data;
+		int res = list_txn(list,move,2);
+		if(res && res != DATA_MISMATCH)
+			return list;
+	}
+	return NULL;
+}
+
+bool testTxn(){
+	linked_list_t* list = list_alloc();
+	int result;
+	for(int i = 1; i <= 5; ++i)
+		ASSERT_ZERO(list_insert(list,i,"Varys"));
+	op_t none[1] = {{ 1, NULL, CONTAINS }};
+	ASSERT_TEST(list_txn(NULL,none,1) == NULL_ARG);
+	ASSERT_TEST(list_txn(list,none,0) == INVALID_ARG);
+
+	op_t commit[6] = {{ 3, NULL, REMOVE }, { 7, "Tyrion", INSERT },
+			{ 4, "Tyrion", UPDATE }, { 5, &result, COMPUTE, firstChar },
+			{ 2, "Tyrion", CAS }, { 3, NULL, CONTAINS }};
+	commit[4].expected = "Varys";
+	ASSERT_ZERO(list_txn(list,commit,6));
+	ASSERT_TEST(result == 'V');
+	ASSERT_TEST(commit[5].result == 0); // sees the removal before it
+	ASSERT_TEST(list_find(list,3) == 0 && list_find(list,7) == 1);
+	ASSERT_ZERO(list_compute(list,2,firstChar,&result));
+	ASSERT_TEST(result == 'T');
+	ASSERT_TEST(list_size(list) == 5);
+
+	//one failing op aborts all of them
+	op_t abort[3] = {{ 1, NULL, REMOVE }, { 6, "Shae", INSERT },
+			{ 2, "Shae", INSERT }};
+	ASSERT_TEST(list_txn(list,abort,3) == ALREADY_IN_LIST);
+	ASSERT_TEST(abort[0].result == SUCCESS && abort[2].result == ALREADY_IN_LIST);
+	ASSERT_TEST(list_find(list,1) == 1 && list_find(list,6) == 0);
+	ASSERT_TEST(list_size(list) == 5);
+
+	//ops of a key see each other
+	op_t same[3] = {{ 9, "Bronn", INSERT }, { 9, "Pod", UPDATE },
+			{ 9, NULL, REMOVE_GET }};
+	ASSERT_ZERO(list_txn(list,same,3));
+	ASSERT_TEST(strcmp(same[2].data,"Pod") == 0);
+	ASSERT_TEST(list_find(list,9) == 0);
+	list_free(list);
+
+	//concurrent transfers keep the total
+	list = list_alloc();
+	pthread_t threads[3];
+	void* failed = NULL;
+	op_t all[ACCOUNTS];
+	for(int i = 0; i < ACCOUNTS; ++i)
+		ASSERT_ZERO(list_insert(list,i,(void*)(long)BALANCE));
+	for(int i = 0; i < 3; ++i)
+		ASSERT_ZERO(pthread_create(&threads[i],NULL,transfer,list));
+	for(int round = 0; round < 100; ++round){
+		long total = 0;
+		for(int i = 0; i < ACCOUNTS; ++i)
+			all[i] = (op_t){ i, NULL, GET_OR_INSERT };
+		ASSERT_ZERO(list_txn(list,all,ACCOUNTS));
+		for(int i = 0; i < ACCOUNTS; ++i)
+			total += (long)all[i].data;
+		ASSERT_TEST(total == ACCOUNTS * BALANCE);
+	}
+	for(int i = 0; i < 3; ++i){
+		void* res;
+		pthread_join(threads[i],&res);
+		failed = failed ? failed : res;
+	}
+	ASSERT_TEST(failed == NULL);
+	list_free(list);
+	return true;
+}
+
+
+static int inside;
+static int waitForOthers(void* data){
+	__atomic_add_fetch(&inside,1,__ATOMIC_SEQ_CST);
+	for(int i = 0; i < 2000 && __atomic_load_n(&inside,__ATOMIC_SEQ_CST) < 3; ++i)
+		usleep(1000);
+	return __atomic_load_n(&inside,__ATOMIC_SEQ_CST) == 3;
+}
+static void* computeHotKey(void* list){
+	int result = 0;
+	list_compute(list,7,waitForOthers,&result);
+	return (void*)(long)result;
+}
+
+bool testSharedCompute(){
+	linked_list_t* list = list_alloc();
+	pthread_t readers[3];
+	void* result;
+	int all_inside = 1;
+	for(int i = 0; i < 10; ++i)
+		ASSERT_ZERO(list_insert(list,i,"Syrio"));
+	inside = 0;
+	//each compute waits until all 3 run at once, so they mustn't exclude each other
+	for(int i = 0; i < 3; ++i)
+		ASSERT_ZERO(pthread_create(&readers[i],NULL,computeHotKey,list));
+	for(int i = 0; i < 3; ++i){
+		pthread_join(readers[i],&result);
+		all_inside = all_inside && result;
+	}
+	ASSERT_TEST(all_inside);
+	ASSERT_ZERO(list_update(list,7,"Forel"));
+	ASSERT_TEST(list_find(list,7) == 1);
+	list_free(list);
+	return true;
+}
+
+
+bool testTraceDump(){
+	linked_list_t* list = list_alloc();
+	ASSERT_ZERO(list_insert(list,1,"Qyburn"));
+	ASSERT_TEST(list_trace_dump(NULL) == NULL_ARG);
+#ifdef MY_LIST_TRACE
+	op_t ops[] = { { 2, "Tyene", INSERT }, { 3, "Obella", INSERT },
+			{ 2, NULL, REMOVE }, { 3, NULL, REMOVE } };
+	trace_file_header_t header;
+	uint32_t num_threads = 0;
+	for (int i = 0; i < 20; i++) {
+		list_batch(list, 4, ops);
+		ASSERT_ZERO(list_trace_dump("my_list_test.trace"));
+		FILE* file = fopen("my_list_test.trace", "rb");
+		ASSERT_TEST(file && fread(&header, sizeof(header), 1, file) == 1);
+		fclose(file);
+		// rings of batch threads which exited are reused
+		ASSERT_TEST(!i || header.num_threads == num_threads);
+		num_threads = header.num_threads;
+	}
+	remove("my_list_test.trace");
+#else
+	ASSERT_TEST(list_trace_dump("my_list_test.trace") == INVALID_ARG);
+#endif
+	list_free(list);
+	return true;
+}
+
+bool testCapture(){
+	linked_list_t* list = list_alloc();
+	op_t ops[2] = {{.key = 2, .data = "Gendry", .op = INSERT},
+			{.key = 1, .op = CONTAINS}};
+	capture_file_header_t header;
+	capture_record_t records[12];
+	ASSERT_TEST(list_capture_start(NULL) == NULL_ARG);
+	ASSERT_TEST(list_capture_stop() == INVALID_ARG);
+	ASSERT_ZERO(list_capture_start("my_list_test.capture"));
+	ASSERT_TEST(list_capture_start("my_list_test.capture") == INVALID_ARG);
+	ASSERT_ZERO(list_insert(list,1,"Arya"));
+	ASSERT_TEST(list_find(list,1) == 1);
+	list_batch(list,2,ops);
+	ASSERT_ZERO(list_remove(list,1));
+	ASSERT_ZERO(list_upsert(list,4,"Hot Pie"));
+	ASSERT_ZERO(list_pop_min(list,NULL,NULL));
+	ASSERT_ZERO(list_freeze(list,3));
+	ASSERT_ZERO(list_capture_stop());
+	ASSERT_ZERO(list_insert(list,3,"Hot Pie")); // not captured
+
+	FILE* file = fopen("my_list_test.capture","rb");
+	ASSERT_TEST(file != NULL);
+	ASSERT_TEST(fread(&header,sizeof(header),1,file) == 1);
+	int n = fread(records,sizeof(*records),12,file);
+	fclose(file);
+	remove("my_list_test.capture");
+	ASSERT_TEST(header.magic == CAPTURE_MAGIC);
+	ASSERT_TEST(n == 9);
+	ASSERT_TEST(records[0].op == TRACE_INSERT && records[0].key == 1);
+	ASSERT_TEST(records[1].op == TRACE_FIND && records[1].key == 1);
+	ASSERT_TEST(records[2].op == TRACE_BATCH && records[2].key == 2);
+	ASSERT_TEST(records[3].op == CAPTURE_MEMBER && records[3].key == 2);
+	ASSERT_TEST(records[3].member_op == INSERT);
+	ASSERT_TEST(records[4].op == CAPTURE_MEMBER && records[4].member_op == CONTAINS);
+	ASSERT_TEST(records[5].op == TRACE_REMOVE);
+	ASSERT_TEST(records[6].op == TRACE_UPSERT && records[6].key == 4);
+	ASSERT_TEST(records[7].op == TRACE_POP_MIN);
+	ASSERT_TEST(records[8].op == TRACE_FREEZE && records[8].key == 3);
+	for(int i = 1; i < n; ++i)
+		ASSERT_TEST(records[i].ts >= records[i-1].ts);
+	list_free(list);
+	return true;
+}
+
+
+static void* insertOdd(void* list){
+	for(int i = 0; i < 1000; ++i)
+		if(list_insert(list,i*2+1,"Podrick") || list_find(list,i*2+1) != 1)
+			return list; // failed
+	return NULL;
+}
+
+bool testOnlineSplit(){
+	linked_list_t* list = list_alloc();
+	linked_list_t* arr[3];
+	pthread_t inserter;
+	void* failed;
+	int result, keys_n = 1000;
+	ASSERT_NON_ZERO(list_split_online(NULL,3,arr));
+	ASSERT_NON_ZERO(list_split_online(list,0,arr));
+	for(int i = 0; i < keys_n; ++i)
+		ASSERT_ZERO(list_insert(list,i*2,"Brienne"));
+
+	//ops keep working on list while its nodes move
+	ASSERT_ZERO(pthread_create(&inserter,NULL,insertOdd,list));
+	ASSERT_ZERO(list_split_online(list,3,arr));
+	pthread_join(inserter,&failed);
+	ASSERT_TEST(failed == NULL);
+
+	ASSERT_TEST(list_size(list) == -CLEANUP_PENDING);
+	ASSERT_TEST(list_split(list,2,arr) == CLEANUP_PENDING);
+	ASSERT_TEST(list_find(list,0) == 1);
+	ASSERT_TEST(list_find(list,1999) == 1);
+	ASSERT_ZERO(list_update(list,10,"Tarth"));
+	ASSERT_ZERO(list_compute(arr[0],10,firstChar,&result));
+	ASSERT_TEST(result == 'T');
+	ASSERT_ZERO(list_remove(list,0));
+	ASSERT_TEST(list_find(arr[0],0) == 0);
+	ASSERT_NON_ZERO(list_insert(list,2,"Brienne"));
+	ASSERT_TEST(list_size(arr[0]) + list_size(arr[1]) + list_size(arr[2])
+			== keys_n * 2 - 1);
+	ASSERT_TEST(list_size(arr[0]) > 0 && list_size(arr[2]) > 0);
+	ASSERT_TEST(list_find(arr[2],1) == 0 && list_find(arr[0],1999) == 0);
+	list_free(list);
+	for(int i = 0; i < 3; ++i)
+		list_free(arr[i]);
+	return true;
+}
+
+bool testCompact(){
+	list_config_t config = {.hash_index_buckets = 256};
+	linked_list_t* list = list_alloc_config(&config);
+	list_compact_stats_t stats;
+	list_hook_t hook, *removed_hook;
+	pthread_t inserter;
+	void* failed;
+	int result, keys_n = 1000;
+	ASSERT_TEST(list_compact(NULL,&stats) == NULL_ARG);
+	//churn: every key is inserted twice as far apart as its neighbours
+	for(int i = 0; i < keys_n*2; ++i)
+		ASSERT_ZERO(list_insert(list,(i*7919)%(keys_n*2),"Gilly"));
+	ASSERT_TEST(list_remove_if(list,isOdd,NULL,NULL) == keys_n);
+	ASSERT_ZERO(list_remove(list,10));
+	ASSERT_ZERO(list_insert_node(list,10,&hook,"Sam"));
+
+	//ops keep working on list while its nodes move
+	ASSERT_ZERO(pthread_create(&inserter,NULL,insertOdd,list));
+	ASSERT_ZERO(list_compact(list,&stats));
+	pthread_join(inserter,&failed);
+	ASSERT_TEST(failed == NULL);
+	ASSERT_TEST(stats.nodes >= keys_n && stats.moved > 0);
+	ASSERT_TEST(stats.local_links_after > stats.local_links_before);
+
+	ASSERT_ZERO(list_compact(list,NULL));
+	ASSERT_ZERO(list_compact(list,&stats)); //nothing left to move
+	ASSERT_TEST(stats.nodes == keys_n*2 && stats.moved == 0);
+	ASSERT_TEST(stats.local_links_after == stats.local_links_before);
+	ASSERT_TEST(stats.local_links_after > keys_n*2*9/10);
+
+	ASSERT_TEST(list_size(list) == keys_n*2);
+	for(int i = 0; i < keys_n*2; ++i)
+		ASSERT_TEST(list_find(list,i) == 1);
+	ASSERT_ZERO(list_compute(list,4,firstChar,&result));
+	ASSERT_TEST(result == 'G');
+	ASSERT_ZERO(list_remove_node(list,10,&removed_hook));
+	ASSERT_TEST(removed_hook == &hook);
+	ASSERT_TEST(list_remove_if(list,isOdd,NULL,NULL) == keys_n);
+	list_free(list);
+	return true;
+}
+
+static int free_calls;
+static void countCalls(void* data){
+	++free_calls;
+}
+
+bool testFreeze(){
+	list_config_t config = {.hash_index_buckets = 256, .bloom_expected_keys = 4000,
+			.bloom_fp_rate = 0.01};
+	linked_list_t* list = list_alloc_config(&config);
+	linked_list_t* arr[3];
+	list_hook_t hook;
+	pthread_t inserter;
+	void* failed;
+	int keys[3], result, keys_n = 1000, sum = 0;
+	ASSERT_TEST(list_freeze(NULL,16) == -NULL_ARG);
+	ASSERT_TEST(list_freeze(list,0) == -INVALID_ARG);
+	for(int i = 0; i < keys_n; ++i)
+		if(i*2 != keys_n)
+			ASSERT_ZERO(list_insert(list,i*2,"Jaqen"));
+	ASSERT_ZERO(list_insert_node(list,keys_n,&hook,"H'ghar"));
+
+	//intrusive nodes stay, and break the run
+	ASSERT_TEST(list_freeze(list,keys_n) == 0);
+	ASSERT_TEST(list_freeze(list,16) == keys_n - 1);
+	ASSERT_TEST(list_freeze(list,16) == 0);
+	ASSERT_TEST(list_size(list) == keys_n);
+	for(int i = 0; i < keys_n*2; ++i)
+		ASSERT_TEST(list_find(list,i) == !(i % 2));
+	ASSERT_ZERO(list_update(list,100,"Arya"));
+	ASSERT_ZERO(list_compute(list,100,firstChar,&result));
+	ASSERT_TEST(result == 'A');
+	ASSERT_ZERO(list_remove(list,0));
+	ASSERT_ZERO(list_remove(list,102));
+	ASSERT_TEST(list_remove(list,102) == NOT_FOUND);
+	ASSERT_TEST(list_insert(list,4,"Jaqen") == ALREADY_IN_LIST);
+
+	//inserts split frozen ranges, while they're read
+	ASSERT_ZERO(pthread_create(&inserter,NULL,insertOdd,list));
+	for(int i = 2; i < keys_n*2; i += 2)
+		ASSERT_TEST(list_find(list,i) == (i != 102));
+	pthread_join(inserter,&failed);
+	ASSERT_TEST(failed == NULL);
+	ASSERT_ZERO(list_insert(list,102,"Syrio"));
+	ASSERT_ZERO(list_compute(list,102,firstChar,&result));
+	ASSERT_TEST(result == 'S');
+	ASSERT_TEST(list_size(list) == keys_n*2 - 1);
+	for(int i = 1; i < keys_n*2; ++i)
+		sum += i;
+	ASSERT_ZERO(list_reduce(list,4,sumKeys,add,NULL,0,&result));
+	ASSERT_TEST(result == sum);
+
+	op_t ops[] = {
+		{ 200, "Waif", UPDATE }, { 202, NULL, REMOVE_GET },
+		{ 203, NULL, REMOVE }, { 202, "Jaqen", INSERT },
+	};
+	ASSERT_ZERO(list_txn(list,ops,4));
+	ASSERT_ZERO(list_compute(list,200,firstChar,&result));
+	ASSERT_TEST(result == 'W');
+	ASSERT_TEST(list_find(list,203) == 0 && list_find(list,202) == 1);
+	ASSERT_ZERO(list_insert(list,203,"Jaqen"));
+
+	ASSERT_TEST(list_pop_min_n(list,3,keys,NULL) == 3);
+	ASSERT_TEST(keys[0] == 1 && keys[1] == 2 && keys[2] == 3);
+	ASSERT_ZERO(list_peek_min(list,keys,NULL));
+	ASSERT_TEST(keys[0] == 4);
+	//views left by the splits merge with the inserted nodes (but the hook)
+	ASSERT_TEST(list_freeze(list,4) == list_size(list) - 1);
+	ASSERT_TEST(list_freeze(list,4) == 0);
+	for(int i = 4; i < keys_n*2; ++i)
+		ASSERT_TEST(list_find(list,i) == 1);
+	ASSERT_TEST(list_remove_if(list,isOdd,NULL,countCalls) == keys_n - 2);
+	ASSERT_TEST(free_calls == keys_n - 2);
+	ASSERT_TEST(list_remove_if(list,isNotAbove,&keys_n,countCalls) == keys_n/2 - 1);
+	ASSERT_TEST(free_calls == keys_n - 2 + keys_n/2 - 1);
+
+	//a frozen range moves whole
+	ASSERT_ZERO(list_split_online(list,3,arr));
+	ASSERT_TEST(list_size(arr[0]) + list_size(arr[1]) + list_size(arr[2])
+			== keys_n/2 - 1);
+	for(int i = keys_n + 2; i < keys_n*2; i += 2)
+		ASSERT_TEST(list_find(list,i) == 1);
+	ASSERT_TEST(list_find(list,keys_n) == 0);
+	list_free(list);
+	for(int i = 0; i < 3; ++i)
+		list_free(arr[i]);
+
+	//a split waits for computes on the view, as their keys may move
+	list = list_alloc();
+	for(int i = 0; i < 64; ++i)
+		if(i != 3)
+			ASSERT_ZERO(list_insert(list,i,"Jaqen"));
+	ASSERT_TEST(list_freeze(list,16) == 63);
+	startHolder(&inserter,readNode,list); //computes on 5
+	ASSERT_TEST(list_try_insert(list,3,"Jaqen") == BUSY);
+	stopHolder(inserter);
+	ASSERT_ZERO(list_insert(list,3,"Jaqen"));
+	ASSERT_ZERO(list_update(list,5,"Arya"));
+	//a view with few keys left goes back to nodes
+	ASSERT_ZERO(list_insert(list,-1,"Jaqen"));
+	for(int i = 0; i < 64; i += 2)
+		ASSERT_ZERO(list_remove(list,i));
+	ASSERT_ZERO(list_insert(list,58,"Jaqen")); //59, 61 and 63 thaw
+	ASSERT_TEST(list_size(list) == 34);
+	for(int i = -1; i < 64; ++i)
+		ASSERT_TEST(list_find(list,i) == (i % 2 != 0 || i == 58));
+	ASSERT_TEST(list_freeze(list,64) == 0);
+	list_free(list);
+	return true;
+}
+
+static list_event_t recorded[16];
+static int recorded_n;
+static void recordEvent(const list_event_t* event, void* ctx){
+	if(recorded_n < 16)
+		recorded[recorded_n++] = *event;
+	if(ctx && event->type == LIST_EVENT_INSERT) //ops of callbacks are fine
+		list_update((linked_list_t*) ctx,event->key + 1,"Gendry");
+}
+
+bool testSubscribe(){
+	linked_list_t* list = list_alloc();
+	list_subscription_t *sub, *queued;
+	list_event_t events[8];
+	ASSERT_TEST(list_subscribe(list,5,1,recordEvent,NULL,0,&sub) == INVALID_ARG);
+	ASSERT_TEST(list_subscribe(list,1,5,NULL,NULL,0,&sub) == INVALID_ARG);
+	ASSERT_TEST(list_subscribe(list,1,5,recordEvent,NULL,0,NULL) == NULL_ARG);
+	ASSERT_ZERO(list_subscribe(list,10,20,recordEvent,list,0,&sub));
+	ASSERT_ZERO(list_subscribe(list,0,15,NULL,NULL,3,&queued));
+	ASSERT_TEST(list_poll_events(sub,events,8) == -INVALID_ARG);
+
+	ASSERT_ZERO(list_insert(list,16,"Arya"));
+	ASSERT_ZERO(list_insert(list,15,"Hot Pie")); //updates 16 from callback
+	ASSERT_ZERO(list_insert(list,30,"Sandor")); //out of range
+	ASSERT_ZERO(list_remove(list,15));
+	ASSERT_TEST(recorded_n == 4);
+	ASSERT_TEST(recorded[0].type == LIST_EVENT_INSERT && recorded[0].key == 16);
+	ASSERT_TEST(recorded[1].type == LIST_EVENT_INSERT && recorded[1].key == 15);
+	ASSERT_TEST(recorded[2].type == LIST_EVENT_UPDATE && recorded[2].key == 16);
+	ASSERT_TEST(strcmp(recorded[2].data,"Gendry") == 0);
+	ASSERT_TEST(recorded[3].type == LIST_EVENT_REMOVE && recorded[3].key == 15);
+	ASSERT_TEST(strcmp(recorded[3].data,"Hot Pie") == 0);
+	for(int i = 1; i < recorded_n; ++i)
+		ASSERT_TEST(recorded[i].seq > recorded[i-1].seq);
+
+	//queue of 4 kept the oldest events, the rest were lost
+	for(int i = 1; i <= 3; ++i)
+		ASSERT_ZERO(list_insert(list,i,"Jaqen"));
+	ASSERT_TEST(list_events_lost(queued) == 1);
+	ASSERT_TEST(list_poll_events(queued,events,8) == 4);
+	ASSERT_TEST(events[0].key == 15 && events[0].type == LIST_EVENT_INSERT);
+	ASSERT_TEST(events[1].key == 15 && events[1].type == LIST_EVENT_REMOVE);
+	ASSERT_TEST(events[3].key == 2);
+	ASSERT_TEST(list_poll_events(queued,events,8) == 0);
+
+	//batches deliver only the net effect of each key
+	op_t ops[] = {
+		{ 12, "Jaqen", INSERT }, { 12, "Waif", UPDATE }, { 13, NULL, INSERT },
+		{ 13, NULL, REMOVE }, { 16, NULL, REMOVE },
+	};
+	ASSERT_ZERO(list_unsubscribe(list,sub));
+	ASSERT_TEST(list_unsubscribe(list,sub) == NOT_FOUND);
+	ASSERT_ZERO(list_subscribe(list,10,20,recordEvent,NULL,0,&sub));
+	recorded_n = 0;
+	list_batch(list,5,ops);
+	ASSERT_TEST(recorded_n == 2);
+	ASSERT_TEST(recorded[0].key == 12 || recorded[1].key == 12);
+	ASSERT_TEST(list_poll_events(queued,events,8) == 1);
+	ASSERT_TEST(events[0].key == 12 && events[0].type == LIST_EVENT_INSERT);
+	ASSERT_TEST(strcmp(events[0].data,"Waif") == 0);
+	ASSERT_TEST(list_txn(list,ops,1) == ALREADY_IN_LIST);
+	ASSERT_TEST(recorded_n == 2);
+
+	//so do removals of frozen keys
+	ASSERT_ZERO(list_unsubscribe(list,queued));
+	for(int i = 4; i < 8; ++i)
+		ASSERT_ZERO(list_insert(list,i,"Jaqen"));
+	ASSERT_ZERO(list_insert(list,0,"Jaqen"));
+	ASSERT_TEST(list_freeze(list,4) == 10);
+	ASSERT_ZERO(list_subscribe(list,0,15,NULL,NULL,8,&queued));
+	ASSERT_TEST(list_pop_min_n(list,2,NULL,NULL) == 2);
+	ASSERT_TEST(list_remove_if(list,isOdd,NULL,NULL) == 3);
+	ASSERT_TEST(list_poll_events(queued,events,8) == 5);
+	ASSERT_TEST(events[0].key == 0 && events[4].key == 7);
+	ASSERT_TEST(strcmp(events[0].data,"Jaqen") == 0);
+	for(int i = 0; i < 5; ++i)
+		ASSERT_TEST(events[i].type == LIST_EVENT_REMOVE);
+	list_free(list); //frees subscriptions left
+	return true;
+}
+
+bool testReadCache(){
+	list_config_t config = {.read_cache = 1};
+	linked_list_t* list = list_alloc_config(&config);
+	linked_list_t* plain = list_alloc();
+	list_stats_t stats;
+	int result;
+	ASSERT_ZERO(list_insert(list,1,"Arya"));
+	ASSERT_TEST(list_find(list,1) == 1);
+	ASSERT_TEST(list_find(list,1) == 1);
+	ASSERT_ZERO(list_compute(list,1,firstChar,&result)); //data is cached too
+	ASSERT_TEST(result == 'A');
+	ASSERT_ZERO(list_stats(list,&stats));
+	ASSERT_TEST(stats.cache_hits == 2 && stats.cache_misses == 1);
+
+	//writes invalidate cached results
+	ASSERT_ZERO(list_update(list,1,"Brienne"));
+	ASSERT_ZERO(list_compute(list,1,firstChar,&result));
+	ASSERT_TEST(result == 'B');
+	ASSERT_ZERO(list_compute(list,1,firstChar,&result));
+	ASSERT_TEST(result == 'B');
+	ASSERT_TEST(list_find(list,2) == 0);
+	ASSERT_TEST(list_compute(list,2,firstChar,&result) == NOT_FOUND);
+	ASSERT_ZERO(list_insert(list,2,"Catelyn"));
+	ASSERT_TEST(list_find(list,2) == 1);
+	ASSERT_ZERO(list_remove(list,1));
+	ASSERT_TEST(list_find(list,1) == 0);
+	op_t ops[] = { { 2, "Daenerys", UPDATE }, { 3, "Eddard", INSERT } };
+	list_batch(list,2,ops);
+	ASSERT_ZERO(list_compute(list,2,firstChar,&result));
+	ASSERT_TEST(result == 'D');
+	ASSERT_ZERO(list_stats(list,&stats));
+	ASSERT_TEST(stats.cache_hits == 4 && stats.cache_misses == 6);
+
+	//so do writes of frozen keys
+	for(int i = 4; i < 20; ++i)
+		ASSERT_ZERO(list_insert(list,i,"Jaqen"));
+	ASSERT_TEST(list_freeze(list,4) == 18);
+	ASSERT_TEST(list_find(list,10) == 1);
+	ASSERT_ZERO(list_update(list,10,"Faceless"));
+	ASSERT_ZERO(list_compute(list,10,firstChar,&result));
+	ASSERT_TEST(result == 'F');
+	ASSERT_ZERO(list_remove(list,10));
+	ASSERT_TEST(list_compute(list,10,firstChar,&result) == NOT_FOUND);
+
+	//writers of a key computed on from cache wait, unless they may fail
+	pthread_t holder;
+	struct timespec deadline;
+	startHolder(&holder,readCachedNode,list);
+	ASSERT_TEST(list_try_update(list,5,"Gendry") == BUSY);
+	ASSERT_TEST(list_try_remove(list,5) == BUSY);
+	deadlineIn(&deadline,20);
+	ASSERT_TEST(list_update_timed(list,5,"Gendry",&deadline) == TIMED_OUT);
+	stopHolder(holder);
+	ASSERT_ZERO(list_try_update(list,5,"Gendry"));
+	ASSERT_ZERO(list_compute(list,5,firstChar,&result));
+	ASSERT_TEST(result == 'G');
+
+	ASSERT_ZERO(list_insert(plain,1,"Arya"));
+	ASSERT_TEST(list_find(plain,1) == 1);
+	ASSERT_ZERO(list_stats(plain,&stats));
+	ASSERT_TEST(stats.cache_hits == 0 && stats.cache_misses == 0);
+	list_free(plain);
+	list_free(list);
+	return true;
+}
+
+static pthread_mutex_t freed_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t freed_cond = PTHREAD_COND_INITIALIZER;
+static int freed;
+static void markFreed(void* ctx){
+	pthread_mutex_lock(&freed_lock);
+	freed += *(int*) ctx;
+	pthread_cond_signal(&freed_cond);
+	pthread_mutex_unlock(&freed_lock);
+}
+
+bool testFreeAsync(){
+	linked_list_t* compacted = list_alloc();
+	linked_list_t* frozen = list_alloc();
+	linked_list_t* list;
+	list_hook_t hook;
+	int one = 1, keys_n = 20000;
+	ASSERT_TEST(list_free_async(NULL,NULL,NULL) == NULL_ARG);
+	for(int i = 0; i < keys_n; ++i){
+		ASSERT_ZERO(list_insert(compacted,(i*7919) % keys_n,"Hodor"));
+		ASSERT_ZERO(list_insert(frozen,i,"Hodor"));
+	}
+	ASSERT_ZERO(list_compact(compacted,NULL));
+	ASSERT_ZERO(list_insert_node(frozen,keys_n,&hook,"Hodor"));
+	ASSERT_TEST(list_freeze(frozen,16) == keys_n);
+
+	ASSERT_ZERO(list_free_async(compacted,markFreed,&one));
+	ASSERT_ZERO(list_free_async(frozen,markFreed,&one));
+	pthread_mutex_lock(&freed_lock);
+	while(freed < 2)
+		pthread_cond_wait(&freed_cond,&freed_lock);
+	pthread_mutex_unlock(&freed_lock);
+
+	//the hook was only unlinked
+	list = list_alloc();
+	ASSERT_ZERO(list_insert_node(list,1,&hook,"Hodor"));
+	list_free(list);
+	return true;
+}
+
+static pthread_mutex_t results_lock = PTHREAD_MUTEX_INITIALIZER;
+static void countResult(int index, const op_t* op, void* ctx){
+	int* results = ctx;
+	pthread_mutex_lock(&results_lock);
+	results[index] = op->result + 1; //0 - not delivered
+	pthread_mutex_unlock(&results_lock);
+}
+
+bool testBatchObject(){
+	list_config_t config = {0};
+	config.batch_workers = 4;
+	linked_list_t* list = list_alloc_config(&config);
+	list_batch_t* batch = list_batch_alloc(2);
+	int keys_n = 2000;
+	int results[2*keys_n];
+	op_t op = {0};
+	ASSERT_TEST(list_batch_run(list,NULL,NULL,NULL) == NULL_ARG);
+	ASSERT_TEST(list_batch_add(batch,NULL) == -NULL_ARG);
+	ASSERT_TEST(list_batch_add(NULL,&op) == -NULL_ARG);
+	ASSERT_ZERO(list_batch_run(list,batch,NULL,NULL)); //empty
+
+	//same batch again and again, grown past its capacity
+	for(int round = 0; round < 3; ++round){
+		list_batch_reset(batch);
+		ASSERT_TEST(list_batch_op(batch,0) == NULL);
+		for(int i = 0; i < 5; ++i){
+			op.key = i;
+			op.data = "Bran";
+			op.op = round == 2 ? REMOVE : INSERT;
+			ASSERT_TEST(list_batch_add(batch,&op) == 2*i);
+			op.op = CONTAINS;
+			ASSERT_TEST(list_batch_add(batch,&op) == 2*i + 1);
+		}
+		memset(results,0,sizeof(results));
+		ASSERT_ZERO(list_batch_run(list,batch,countResult,results));
+		for(int i = 0; i < 5; ++i){
+			ASSERT_TEST(results[2*i] == (round == 1 ? ALREADY_IN_LIST : SUCCESS) + 1);
+			ASSERT_TEST(list_batch_op(batch,2*i + 1)->result == (round < 2));
+			ASSERT_TEST(results[2*i + 1] == (round < 2) + 1);
+		}
+		ASSERT_TEST(list_size(list) == (round < 2 ? 5 : 0));
+	}
+
+	//big enough for several workers
+	list_batch_reset(batch);
+	for(int i = 0; i < keys_n; ++i){
+		op.key = keys_n - 1 - i;
+		op.op = op.key % 2 ? INSERT : CONTAINS;
+		ASSERT_TEST(list_batch_add(batch,&op) == i);
+	}
+	for(int i = 0; i < keys_n; ++i){
+		op.key = i;
+		op.op = CONTAINS;
+		ASSERT_TEST(list_batch_add(batch,&op) == keys_n + i);
+	}
+	memset(results,0,sizeof(results));
+	ASSERT_ZERO(list_batch_run(list,batch,countResult,results));
+	for(int i = 0; i < keys_n; ++i){
+		ASSERT_TEST(results[i] == 1); //inserted, or not found
+		ASSERT_TEST(results[keys_n + i] == i % 2 + 1);
+	}
+	ASSERT_TEST(list_size(list) == keys_n/2);
+	list_batch_free(batch);
+	list_free(list);
+	return true;
+}
+
 int main(){
 	RUN_TEST(testFreeErrors);
 	RUN_TEST(testSplitErrors);
@@ -687,6 +1936,29 @@ int main(){
 	RUN_TEST(testBatchErrors);
 	RUN_TEST(testSequential1);
 	RUN_TEST(testSequential2);
+	RUN_TEST(testBatchCoalescing);
+	RUN_TEST(testForEachReduce);
+	RUN_TEST(testCompoundOps);
+	RUN_TEST(testRemoveIf);
+	RUN_TEST(testBloomFilter);
+	RUN_TEST(testAdaptiveLocking);
+	RUN_TEST(testBatchPartitioned);
+	RUN_TEST(testPriorityQueue);
+	RUN_TEST(testHashIndex);
+	RUN_TEST(testIntrusiveNodes);
+	RUN_TEST(testIntrusiveReplace);
+	RUN_TEST(testTryAndTimed);
+	RUN_TEST(testSharedCompute);
+	RUN_TEST(testTxn);
+	RUN_TEST(testTraceDump);
+	RUN_TEST(testCapture);
+	RUN_TEST(testOnlineSplit);
+	RUN_TEST(testCompact);
+	RUN_TEST(testFreeze);
+	RUN_TEST(testSubscribe);
+	RUN_TEST(testReadCache);
+	RUN_TEST(testFreeAsync);
+	RUN_TEST(testBatchObject);
 
 	return 0;
 }
@@ -0,0 +1,106 @@
+/*
+ * my_list_trace.h
+ *
+ * Binary format of list traces, written by list_trace_dump (when my_list.c
+ * is compiled with -DMY_LIST_TRACE), and read by my_list_trace_decode,
+ * and of workload captures, written by list_capture_start/stop, and
+ * replayed by my_list_replay.
+ *
+ * A dump is a trace_file_header_t, followed by num_threads blocks, each a
+ * trace_thread_header_t and its num_events events, oldest first.
+ */
+
+#ifndef __MYLIST_TRACE_H_
+#define __MYLIST_TRACE_H_
+
+#include <stdint.h>
+
+#define TRACE_MAGIC 0x5254534cu // "LSTR"
+#define TRACE_VERSION 1
+
+typedef enum trace_event_type_t {
+	TRACE_OP_START,
+	TRACE_OP_END,		// result - return code of the op
+	TRACE_LOCK_WAIT,	// arg - ticks waited for a contended lock
+	TRACE_CLEANUP_WAIT,	// list_free/list_split waits for cleanup_lock
+	TRACE_CLEANUP_LOCKED,// arg - ticks waited, result - 0 if another cleanup won
+	TRACE_CLEANUP_DONE
+} trace_event_type_t;
+
+typedef enum trace_op_t {
+	TRACE_INSERT,
+	TRACE_REMOVE,
+	TRACE_FIND,
+	TRACE_UPDATE,
+	TRACE_COMPUTE,
+	TRACE_BATCH,		// key - number of ops
+	TRACE_SPLIT,		// split and free record cleanup events only
+	TRACE_FREE,
+	TRACE_TXN,		// key - number of ops
+	TRACE_UPSERT,
+	TRACE_REMOVE_GET,
+	TRACE_CAS,
+	TRACE_GET_OR_INSERT,
+	TRACE_INSERT_NODE,
+	TRACE_REMOVE_NODE,
+	TRACE_PEEK_MIN,		// key - 0
+	TRACE_POP_MIN,		// key - 0
+	TRACE_POP_MIN_N,	// key - n, result - number popped (or -error)
+	TRACE_POP_MIN_SPRAY,	// key - k
+	TRACE_REMOVE_IF,	// key - 0, result - number removed (or -error)
+	TRACE_FOR_EACH,		// key - number of threads
+	TRACE_REDUCE,		// key - number of threads
+	TRACE_COMPACT,		// key - 0
+	TRACE_FREEZE,		// key - min_run, result - keys frozen (or -error)
+	TRACE_NUM_OPS
+} trace_op_t;
+
+typedef struct trace_event_t {
+	uint64_t ts; // ticks of the trace clock (TSC on x86, else ns)
+	int32_t key;
+	uint32_t arg;
+	uint8_t type; // trace_event_type_t
+	uint8_t op; // trace_op_t, of the op in progress
+	int16_t result; // counts above INT16_MAX are cut to it
+	uint32_t reserved;
+} trace_event_t;
+
+typedef struct trace_file_header_t {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_threads;
+	uint32_t reserved;
+	double ns_per_tick; // of the trace clock, measured while tracing
+} trace_file_header_t;
+
+typedef struct trace_thread_header_t {
+	uint32_t thread; // ring, in order of creation (a ring whose thread
+			 // exited goes on with the next thread which traces)
+	uint32_t num_events;
+	uint64_t overwritten; // older events, lost when the ring wrapped
+} trace_thread_header_t;
+
+/* A capture (see list_capture_start) is a capture_file_header_t, followed
+ * by records. Records of a thread come in the order of its ops, but records
+ * of different threads interleave (in chunks). A TRACE_BATCH or TRACE_TXN
+ * record (key - number of ops) is followed by a CAPTURE_MEMBER record for
+ * each of its ops, in their order. Records of ops on no single key hold
+ * what trace_op_t says in key. */
+#define CAPTURE_MAGIC 0x5041434cu // "LCAP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_MEMBER 0xff
+
+typedef struct capture_file_header_t {
+	uint32_t magic;
+	uint32_t version;
+} capture_file_header_t;
+
+typedef struct capture_record_t {
+	uint64_t ts; // ns since the capture started
+	int32_t key;
+	uint16_t thread; // order in which threads first logged an op
+	uint8_t op; // trace_op_t, or CAPTURE_MEMBER
+	uint8_t member_op; // op field of op_t, for CAPTURE_MEMBER
+} capture_record_t;
+
+#endif /* __MYLIST_TRACE_H_ */
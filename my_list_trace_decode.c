@@ -0,0 +1,213 @@
+/*
+ * my_list_trace_decode.c
+ *
+ * Turns a dump of list_trace_dump into a timeline (events of all threads,
+ * by time), followed by latency summary of every op.
+ *
+ * Build:
+ *   gcc -O2 my_list_trace_decode.c -o my_list_trace_decode
+ * Run:
+ *   ./my_list_trace_decode dump_file
+ */
+
+#include "my_list.h"
+#include "my_list_trace.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct decoded_event_t {
+	trace_event_t event;
+	uint32_t thread;
+} decoded_event_t;
+
+typedef struct op_summary_t {
+	uint64_t count, total_ns, max_ns;
+} op_summary_t;
+
+static const char* const op_names[TRACE_NUM_OPS] = {
+	[TRACE_INSERT] = "insert", [TRACE_REMOVE] = "remove", [TRACE_FIND] = "find",
+	[TRACE_UPDATE] = "update", [TRACE_COMPUTE] = "compute",
+	[TRACE_BATCH] = "batch", [TRACE_SPLIT] = "split", [TRACE_FREE] = "free",
+	[TRACE_TXN] = "txn", [TRACE_UPSERT] = "upsert",
+	[TRACE_REMOVE_GET] = "remove_get", [TRACE_CAS] = "cas_data",
+	[TRACE_GET_OR_INSERT] = "get_or_insert", [TRACE_INSERT_NODE] = "insert_node",
+	[TRACE_REMOVE_NODE] = "remove_node", [TRACE_PEEK_MIN] = "peek_min",
+	[TRACE_POP_MIN] = "pop_min", [TRACE_POP_MIN_N] = "pop_min_n",
+	[TRACE_POP_MIN_SPRAY] = "pop_min_spray", [TRACE_REMOVE_IF] = "remove_if",
+	[TRACE_FOR_EACH] = "for_each", [TRACE_REDUCE] = "reduce",
+	[TRACE_COMPACT] = "compact", [TRACE_FREEZE] = "freeze"
+};
+
+static const char* const result_names[] = {
+	[SUCCESS] = "SUCCESS", [NULL_ARG] = "NULL_ARG",
+	[INVALID_ARG] = "INVALID_ARG", [MEM_ERROR] = "MEM_ERROR",
+	[NOT_FOUND] = "NOT_FOUND", [ALREADY_IN_LIST] = "ALREADY_IN_LIST",
+	[CLEANUP_PENDING] = "CLEANUP_PENDING", [DATA_MISMATCH] = "DATA_MISMATCH",
+	[BUSY] = "BUSY", [TIMED_OUT] = "TIMED_OUT"
+};
+
+static const char* op_name(unsigned op) {
+	return op < TRACE_NUM_OPS && op_names[op] ? op_names[op] : "?";
+}
+
+//ops which return a count, or a negative error code
+static int returns_count(unsigned op) {
+	return op == TRACE_POP_MIN_N || op == TRACE_REMOVE_IF || op == TRACE_FREEZE;
+}
+
+static void print_result(const trace_event_t* event) {
+	int res = event->result;
+	if (returns_count(event->op)) {
+		if (res >= 0) {
+			printf("%d", res);
+			return;
+		}
+		res = -res;
+	}
+	if (event->op == TRACE_FIND && (res == 0 || res == 1))
+		printf("%s", res ? "found" : "not found"); // list_find returns 0/1
+	else if (res >= 0 && res < (int) (sizeof(result_names) / sizeof(*result_names))
+			&& result_names[res])
+		printf("%s", result_names[res]);
+	else
+		printf("%d", res);
+}
+
+static int compare_by_time(const void* a, const void* b) {
+	const decoded_event_t *e1 = a, *e2 = b;
+	if (e1->event.ts != e2->event.ts)
+		return e1->event.ts < e2->event.ts ? -1 : 1;
+	return e1->thread < e2->thread ? -1 : e1->thread > e2->thread;
+}
+
+//@Return: 0 on success
+static int read_dump(FILE* file, decoded_event_t** decoded,
+		uint32_t* num_threads, size_t* num_events, double* ns_per_tick) {
+	trace_file_header_t header;
+	if (fread(&header, sizeof(header), 1, file) != 1
+			|| header.magic != TRACE_MAGIC || header.version != TRACE_VERSION) {
+		fprintf(stderr, "not a list trace (or of another version)\n");
+		return 1;
+	}
+	decoded_event_t* events = NULL;
+	size_t count = 0;
+	for (uint32_t i = 0; i < header.num_threads; i++) {
+		trace_thread_header_t thread;
+		if (fread(&thread, sizeof(thread), 1, file) != 1)
+			goto truncated;
+		if (thread.overwritten)
+			printf("thread %u: %" PRIu64 " older events were overwritten\n",
+					thread.thread, thread.overwritten);
+		decoded_event_t* more = realloc(events,
+				(count + thread.num_events) * sizeof(*events));
+		if (!more && thread.num_events) {
+			fprintf(stderr, "out of memory\n");
+			free(events);
+			return 1;
+		}
+		events = more;
+		for (uint32_t j = 0; j < thread.num_events; j++, count++) {
+			if (fread(&events[count].event, sizeof(trace_event_t), 1, file) != 1)
+				goto truncated;
+			events[count].thread = thread.thread;
+		}
+	}
+	*decoded = events;
+	*num_threads = header.num_threads;
+	*num_events = count;
+	*ns_per_tick = header.ns_per_tick;
+	return 0;
+
+truncated:
+	fprintf(stderr, "dump is truncated\n");
+	free(events);
+	return 1;
+}
+
+int main(int argc, char** argv) {
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s dump_file\n", argv[0]);
+		return 1;
+	}
+	FILE* file = fopen(argv[1], "rb");
+	if (!file) {
+		perror(argv[1]);
+		return 1;
+	}
+	decoded_event_t* events;
+	uint32_t num_threads;
+	size_t num_events;
+	double ns_per_tick;
+	int res = read_dump(file, &events, &num_threads, &num_events, &ns_per_tick);
+	fclose(file);
+	if (res)
+		return 1;
+	if (!num_events) {
+		printf("no events\n");
+		free(events);
+		return 0;
+	}
+	qsort(events, num_events, sizeof(*events), compare_by_time);
+
+	// start time of the op in progress, per thread
+	uint64_t* op_start = calloc(num_threads, sizeof(*op_start));
+	op_summary_t summary[TRACE_NUM_OPS] = {{0}};
+	if (!op_start)
+		return 1;
+	uint64_t t0 = events[0].event.ts;
+	printf("%12s %6s  event\n", "time(us)", "thread");
+	for (size_t i = 0; i < num_events; i++) {
+		const trace_event_t* event = &events[i].event;
+		uint32_t thread = events[i].thread;
+		printf("%12.3f %6u  ", (event->ts - t0) * ns_per_tick / 1000.0, thread);
+		switch (event->type) {
+		case TRACE_OP_START:
+			op_start[thread] = event->ts;
+			printf("%s key=%d start\n", op_name(event->op), event->key);
+			break;
+		case TRACE_OP_END:
+			printf("%s key=%d -> ", op_name(event->op), event->key);
+			print_result(event);
+			if (op_start[thread] && event->op < TRACE_NUM_OPS) {
+				uint64_t took = (event->ts - op_start[thread]) * ns_per_tick;
+				printf(" (%" PRIu64 " ns)", took);
+				summary[event->op].count++;
+				summary[event->op].total_ns += took;
+				if (took > summary[event->op].max_ns)
+					summary[event->op].max_ns = took;
+			}
+			op_start[thread] = 0;
+			printf("\n");
+			break;
+		case TRACE_LOCK_WAIT:
+			printf("  lock wait %.0f ns (%s key=%d)\n", event->arg * ns_per_tick,
+					op_name(event->op), event->key);
+			break;
+		case TRACE_CLEANUP_WAIT:
+			printf("%s waits for cleanup lock\n", op_name(event->op));
+			break;
+		case TRACE_CLEANUP_LOCKED:
+			printf("%s %s cleanup lock after %.0f ns\n", op_name(event->op),
+					event->result ? "got" : "lost", event->arg * ns_per_tick);
+			break;
+		case TRACE_CLEANUP_DONE:
+			printf("%s done, list destroyed\n", op_name(event->op));
+			break;
+		default:
+			printf("unknown event %u\n", event->type);
+		}
+	}
+
+	printf("\n%-13s %10s %12s %12s\n", "op", "count", "mean(ns)", "max(ns)");
+	for (int op = 0; op < TRACE_NUM_OPS; op++) {
+		if (!summary[op].count)
+			continue;
+		printf("%-13s %10" PRIu64 " %12" PRIu64 " %12" PRIu64 "\n", op_name(op),
+				summary[op].count, summary[op].total_ns / summary[op].count,
+				summary[op].max_ns);
+	}
+	free(op_start);
+	free(events);
+	return 0;
+}